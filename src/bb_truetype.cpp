@@ -39,6 +39,12 @@ bb_truetype::bb_truetype() {
     bbttInit(&_bbtt);
 }
 
+#ifdef BBTT_POSIX
+bb_truetype::~bb_truetype() {
+    bbttAsyncStop(&_bbtt); // the worker thread uses _bbtt
+}
+#endif
+
 void bb_truetype::end() {
     bbttEnd(&_bbtt);
 }
@@ -47,6 +53,74 @@ void bb_truetype::setTextAlignment(uint8_t _alignment) {
     _bbtt.textAlign = _alignment;
 }
 
+void bb_truetype::setGlyphTable(uint16_t *pTable, uint16_t u16First, uint16_t u16Last) {
+    bbttSetGlyphTable(&_bbtt, pTable, u16First, u16Last);
+}
+
+void bb_truetype::setGlyphCache(uint8_t *pBuffer, uint32_t u32Size) {
+    bbttSetGlyphCache(&_bbtt, pBuffer, u32Size);
+}
+
+void bb_truetype::getGlyphCacheStats(ttCacheStats_t *pStats) {
+    if (pStats) {
+        *pStats = _bbtt.glyphCache.stats;
+    }
+}
+
+void bb_truetype::setBitmapCache(uint8_t *pBuffer, uint32_t u32Size) {
+    bbttSetBitmapCache(&_bbtt, pBuffer, u32Size);
+}
+
+void bb_truetype::getBitmapCacheStats(ttCacheStats_t *pStats) {
+    if (pStats) {
+        *pStats = _bbtt.bitmapCache.stats;
+    }
+}
+
+void bb_truetype::setFileBuffer(uint8_t *pBuffer, int iSize, uint8_t bReadAhead) {
+    bbttSetFileBuffer(&_bbtt, pBuffer, iSize, bReadAhead);
+}
+
+uint8_t bb_truetype::setPageCache(uint8_t *pBuffer, uint32_t u32Size, int iPageSize, int iPinned, uint8_t bReadAhead) {
+    return bbttSetPageCache(&_bbtt, pBuffer, u32Size, iPageSize, iPinned, bReadAhead);
+}
+
+void bb_truetype::getIOStats(ttIOStats_t *pStats) {
+    if (pStats) {
+        *pStats = _bbtt.ioStats;
+    }
+}
+
+void bb_truetype::getOutlineStats(ttOutlineStats_t *pStats) {
+    if (pStats) {
+        *pStats = _bbtt.outlineStats;
+    }
+}
+
+void bb_truetype::setPrefetchBuffer(uint8_t *pBuffer, uint32_t u32Size) {
+    bbttSetPrefetchBuffer(&_bbtt, pBuffer, u32Size);
+}
+
+void bb_truetype::setIndexBuffer(uint8_t *pBuffer, uint32_t u32Size) {
+    bbttSetIndexBuffer(&_bbtt, pBuffer, u32Size);
+}
+
+// returns the TT_INDEX_xxx flags of the preloaded tables
+uint8_t bb_truetype::getIndexTables(uint32_t *pUsed) {
+    if (pUsed) {
+        *pUsed = _bbtt.u32IndexUsed;
+    }
+    return _bbtt.u8IndexTables;
+}
+
+void bb_truetype::setLazyOpen(uint8_t bLazy) {
+    _bbtt.bLazyOpen = bLazy;
+}
+
+int bb_truetype::checkFont(uint32_t u32MaxBytes) {
+    return bbttCheckFont(&_bbtt, u32MaxBytes);
+}
+
 #ifdef ESP32
 uint8_t bb_truetype::setTtfFile(File _file, uint8_t _checkCheckSum)
 {
@@ -58,10 +132,44 @@ void bb_truetype::setTtfDrawLine(TTF_DRAWLINE *p) {
     _bbtt.pfnDrawLine = p;
 }
 
+void bb_truetype::setTtfDrawAlpha(TTF_DRAWALPHA *p) {
+    _bbtt.pfnDrawAlpha = p;
+}
+
+void bb_truetype::setTtfDrawSpans(TTF_DRAWSPANS *p) {
+    _bbtt.pfnDrawSpans = p;
+}
+
+void bb_truetype::setTtfDrawBitmap(TTF_DRAWBITMAP *p) {
+    _bbtt.pfnDrawBitmap = p;
+}
+
 uint8_t bb_truetype::setTtfPointer(uint8_t *p, uint32_t u32Size, uint8_t _checkCheckSum){
     return bbttSetTtfPointer(&_bbtt, p, u32Size, _checkCheckSum);
 }
 
+uint8_t bb_truetype::setTtfCallbacks(void *fHandle, int32_t iSize, TTF_READ_CALLBACK *pfnRead, TTF_SEEK_CALLBACK *pfnSeek, TTF_CLOSE_CALLBACK *pfnClose, uint8_t _checkCheckSum) {
+    return bbttSetTtfCallbacks(&_bbtt, fHandle, iSize, pfnRead, pfnSeek, pfnClose, _checkCheckSum);
+}
+
+uint8_t bb_truetype::setTtzPointer(const uint8_t *pData, uint32_t u32Size, uint8_t *pCache, uint32_t u32CacheSize, uint8_t _checkCheckSum) {
+    return bbttSetTtzPointer(&_bbtt, pData, u32Size, pCache, u32CacheSize, _checkCheckSum);
+}
+
+#ifdef BBTT_POSIX
+uint8_t bb_truetype::openTtfFile(const char *szName, uint8_t _checkCheckSum) {
+    return bbttOpenTtfFile(&_bbtt, szName, _checkCheckSum);
+}
+
+uint8_t bb_truetype::mapTtfFile(const char *szName, uint8_t _checkCheckSum) {
+    return bbttMapTtfFile(&_bbtt, szName, _checkCheckSum);
+}
+
+uint8_t bb_truetype::setAsyncPrefetch(uint8_t *pBuffer, uint32_t u32Size, int iLookahead) {
+    return bbttSetAsyncPrefetch(&_bbtt, pBuffer, u32Size, iLookahead);
+}
+#endif // BBTT_POSIX
+
 void bb_truetype::setFramebuffer(uint16_t _framebufferWidth, uint16_t _framebufferHeight, uint16_t _framebuffer_bit, uint8_t *_framebuffer)
 {
     bbttSetFramebuffer(&_bbtt, _framebufferWidth, _framebufferHeight, _framebuffer_bit, _framebuffer);
@@ -83,10 +191,31 @@ void bb_truetype::setTextColor(uint32_t _onLine, uint32_t _inside) {
     bbttSetTextColor(&_bbtt, _onLine, _inside);
 }
 
+void bb_truetype::setTextAntialias(uint8_t _mode) {
+    bbttSetTextAntialias(&_bbtt, _mode);
+}
+
+void bb_truetype::setAntialiasBuffer(uint8_t *pBuffer, uint32_t u32Size) {
+    bbttSetAntialiasBuffer(&_bbtt, pBuffer, u32Size);
+}
+
+void bb_truetype::setCurveTolerance(uint8_t _tolerance) {
+    bbttSetCurveTolerance(&_bbtt, _tolerance);
+}
+
 void bb_truetype::setTextRotation(uint16_t _rotation) {
     bbttSetRotation(&_bbtt, _rotation);
 }
 
+void bb_truetype::setTextTransform(int32_t xx, int32_t xy, int32_t tx, int32_t yx, int32_t yy, int32_t ty) {
+    ttTransform_t t = {xx, xy, tx, yx, yy, ty};
+    bbttSetTransform(&_bbtt, &t);
+}
+
+void bb_truetype::setTextAngle(int16_t iDegrees, int16_t _x, int16_t _y) {
+    bbttSetTextAngle(&_bbtt, iDegrees, _x, _y);
+}
+
 void bb_truetype::textDraw(int16_t _x, int16_t _y, const wchar_t _character[]) {
     bbttTextDraw(&_bbtt, _x, _y, _character);
 }
@@ -113,7 +242,7 @@ uint16_t bb_truetype::getStringWidth(const char *szString) {
     return bbttGetStringWidth(&_bbtt, szString);
 }
 
-void bb_truetype::getCharBox(wchar_t _c, ttCharBox_t *pBox) {
+void bb_truetype::getCharBox(uint32_t _c, ttCharBox_t *pBox) {
     bbttGetCharBox(&_bbtt, _c, pBox);
 }
 
@@ -143,7 +272,7 @@ uint16_t bb_truetype::getStringWidth(const String _string) {
 /* calculate */
 void bb_truetype::stringToWchar(String _string, wchar_t _charctor[]) {
     uint16_t s = 0;
-    uint8_t c = 0;
+    uint16_t c = 0;
     uint32_t codeu32;
 
     while (_string[s] != '\0') {
@@ -203,12 +332,12 @@ void bb_truetype::stringToWchar(String _string, wchar_t _charctor[]) {
             continue;
         }
 
-        if (codeu32 < 0x10000) {
-            _charctor[c] = char16_t(codeu32);
-        } else {
-            _charctor[c] = ((char16_t((codeu32 - 0x10000) % 0x400 + 0xDC00)) << 8) || (char16_t((codeu32 - 0x10000) / 0x400 + 0xD800));
+        if (codeu32 < 0x10000 || sizeof(wchar_t) >= 4) {
+            _charctor[c++] = wchar_t(codeu32);
+        } else { // 16-bit wchar_t; store a surrogate pair (a 4 byte UTF-8 sequence has room for it)
+            _charctor[c++] = wchar_t((codeu32 - 0x10000) / 0x400 + 0xD800);
+            _charctor[c++] = wchar_t((codeu32 - 0x10000) % 0x400 + 0xDC00);
         }
-        c++;
     }
     _charctor[c] = 0;
 }
@@ -19,7 +19,6 @@ total rewrite and optimization by Larry Bank
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
-#include <math.h>
 typedef uint8_t byte;
 #endif
 
@@ -31,6 +30,16 @@ typedef uint8_t byte;
 #include "FS.h"
 #endif /*FS_H*/
 
+// file (pread) and memory mapped font backends for Linux/macOS builds
+#if !defined(ARDUINO) && (defined(__linux__) || defined(__APPLE__))
+#define BBTT_POSIX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#endif
+
 // Use this to skip either drawing the outline or the inside
 #define COLOR_NONE 0x80000001
 
@@ -40,12 +49,45 @@ typedef uint8_t byte;
 // allocation within the library
 
 #define MAX_POINTS 1024
-#define MAX_ENDPOINTS 16
-
 #define MAX_CONTOURS 16
+// one more than the contours; the outline records where the next one would start
+#define MAX_ENDPOINTS (MAX_CONTOURS + 1)
+// fill edge table; each outline line starts one edge. A glyph with more
+// edges is filled in bands of rows whose edges fit, so a bigger table only
+// saves the extra passes over the outline (a single row crossing more than
+// MAX_EDGES edges is left empty)
+#ifndef MAX_EDGES
+#define MAX_EDGES 64
+#endif
+
 #define MAX_GLYPH_POINTS 256
+// scratch buffer for the flags and coordinates of a glyph record that isn't
+// in memory (at most 5 bytes per point); a bigger record is read in pieces.
+// A multiple of 4 (it's also used to read the tables for their checksums)
+#ifndef GLYPH_BUF_SIZE
+#define GLYPH_BUF_SIZE (MAX_GLYPH_POINTS * 5)
+#endif
+#if GLYPH_BUF_SIZE < 16 || (GLYPH_BUF_SIZE & 3)
+#error GLYPH_BUF_SIZE must be a multiple of 4 of at least 16
+#endif
+// compound glyphs can be built from other compound glyphs
+#define MAX_COMPOUND_DEPTH 4
 
 #define MAX_TABLES 64
+// big-endian loads from font bytes (see bbttGetRecord)
+#define TT_U16(p) ((uint16_t)(((p)[0] << 8) | (p)[1]))
+#define TT_S16(p) ((int16_t)TT_U16(p))
+#define TT_U32(p) (((uint32_t)(p)[0] << 24) | ((uint32_t)(p)[1] << 16) | ((uint32_t)(p)[2] << 8) | (uint32_t)(p)[3])
+// table tag as a big-endian 32-bit value so the directory can be searched without strcmp
+#define TT_TAG(a, b, c, d) (((uint32_t)(a) << 24) | ((uint32_t)(b) << 16) | ((uint32_t)(c) << 8) | (uint32_t)(d))
+
+// tables held in the index buffer (see setIndexBuffer)
+#define TT_INDEX_CMAP 1
+#define TT_INDEX_LOCA 2
+#define TT_INDEX_HMTX 4
+
+// number of fill runs batched for the DrawSpans callback
+#define MAX_SPANS 128
 
 #define FLAG_ONCURVE (1 << 0)
 #define FLAG_XSHORT (1 << 1)
@@ -58,11 +100,44 @@ typedef uint8_t byte;
 #define TEXT_ALIGN_CENTER 1
 #define TEXT_ALIGN_RIGHT 2
 
+// Anti-aliased fill modes (number of alpha bits)
+#define TEXT_AA_NONE 0
+#define TEXT_AA_4BIT 4
+#define TEXT_AA_8BIT 8
+// sub-pixel precision of the anti-aliased outline (1/16th of a pixel)
+#define AA_SHIFT 4
+#define AA_ONE (1 << AA_SHIFT)
+// bytes of setAntialiasBuffer memory for glyph boxes up to w pixels wide
+// (wider glyphs are clipped)
+#define AA_BUFFER_SIZE(w) (((w) + 2) * 4 + (w) + 3)
+// curves are split into as many line segments as it takes to stay within
+// the tolerance (in 1/16ths of an output pixel, see setCurveTolerance)
+#ifndef CURVE_TOLERANCE
+#define CURVE_TOLERANCE 1
+#endif
+#define MAX_CURVE_STEPS 16
+// a glyph with more fill edges than this per pixel row has its (nearly)
+// straight runs of outline lines merged, first within the curve tolerance,
+// then with twice as much until it fits or reaches 1/4 pixel
+#ifndef MAX_ROW_EDGES
+#define MAX_ROW_EDGES 16
+#endif
+// most outline lines one fill edge can replace in that case
+#define MAX_MERGE_POINTS 32
+
+// setTextRotation; the drawing callbacks receive the turned (framebuffer)
+// co-ordinates, not the text's own
 #define ROTATE_0 0
 #define ROTATE_90 1
 #define ROTATE_180 2
 #define ROTATE_270 3
 
+// kinds of text transform (see setTextTransform)
+#define TRANSFORM_NONE 0
+#define TRANSFORM_QUARTER 1 // quarter turns and flips; text keeps the pixels it has unturned
+#define TRANSFORM_WHOLE 2   // other whole pixel steps (integer scales and skews)
+#define TRANSFORM_ANY 3
+
 enum {
     BBTT_SUCCESS = 0,
     BBTT_INVALID_FILE,
@@ -70,11 +145,154 @@ enum {
     BBTT_GLYPH_NOT_FOUND
 };
 
+// checkFont() results
+#define TT_CHECK_FAILED -1
+#define TT_CHECK_PENDING 0
+#define TT_CHECK_OK 1
+
+// default read buffer for file fonts; setFileBuffer() can supply a different one
+#ifndef FILE_BUF_SIZE
 #define FILE_BUF_SIZE 512
+#endif
+// most pages the file read buffer can be split into (see setPageCache)
+#define MAX_FILE_PAGES 16
+// hits that make a page of cmap/loca data a candidate for pinning
+#define PAGE_PIN_HITS 8
+
+// Font I/O backend; the read callback advances iPos, the seek callback sets it
+typedef struct ttfile_tag {
+    int32_t iPos;  // current position of the backend
+    int32_t iSize; // size of the font in bytes
+    uint8_t *pData; // memory mapped data (if any)
+    void *fHandle; // backend specific handle
+} TTFILE;
+typedef int32_t(TTF_READ_CALLBACK)(TTFILE *pFile, uint8_t *pBuf, int32_t iLen);
+typedef int32_t(TTF_SEEK_CALLBACK)(TTFILE *pFile, int32_t iPosition);
+typedef void(TTF_CLOSE_CALLBACK)(TTFILE *pFile);
+
+// a page of the file read buffer; holds iSize bytes from u32Start on
+typedef struct {
+    uint32_t u32Start;
+    int iSize;            // valid bytes (0 = empty)
+    uint32_t u32LastUse;
+    uint16_t u16Hits;
+    uint8_t bPinned;      // cmap/loca data that stays until the font changes
+} ttPage_t;
+
+// file font I/O counters
+typedef struct {
+    uint32_t u32Reads;         // calls to the read callback
+    uint32_t u32Seeks;         // calls to the seek callback
+    uint32_t u32BufferedSeeks; // seeks that landed in the read buffer
+    uint32_t u32BytesRead;
+    uint32_t u32PageHits;      // reads served from a page of the read buffer
+    uint32_t u32PageMisses;    // pages (re)filled from the backend
+    // string prefetch; savings are compared with reading the same glyph records in drawing order
+    uint32_t u32PrefetchReads;   // reads made to stage glyph records (also counted in u32Reads)
+    uint32_t u32PrefetchRecords; // glyph records then drawn from the staging buffer
+    uint32_t u32ReadsSaved;
+    uint32_t u32SeekBytesSaved;  // distance the read position didn't have to jump
+    // background prefetch (see setAsyncPrefetch)
+    uint32_t u32AsyncRecords;    // glyph records drawn from the worker's reads
+    uint32_t u32AsyncWaits;      // times drawing had to wait for the worker
+    // block compressed fonts (see setTtzPointer)
+    uint32_t u32BlocksDecoded;   // blocks decompressed into the block cache
+    uint32_t u32BlockHits;       // reads served from an already decompressed block
+} ttIOStats_t;
+
+// Block compressed font container (made by tools/ttf2ttz.c). All values are little endian:
+//   "TTZ1", uint32 font size, uint8 log2(block size), 3 reserved bytes,
+//   (block count + 1) uint32 offsets of the compressed blocks from the start of the container
+// Each block decompresses on its own; a block the size of its uncompressed data is stored as is
+#define TTZ_HEADER_SIZE 12
+#define TTZ_MIN_BLOCK_SHIFT 8
+#define TTZ_MAX_BLOCK_SHIFT 15
+// most blocks the block cache can hold
+#define MAX_TTZ_BLOCKS 16
+typedef struct {
+    const uint8_t *pData;     // the container
+    uint32_t u32DataSize;
+    uint32_t u32BlockCount;
+    uint8_t u8BlockShift;
+    uint8_t *pCache;          // caller supplied; iSlots decompressed blocks
+    int iSlots;
+    int iLastSlot;            // slot of the last block read
+    int32_t iBlock[MAX_TTZ_BLOCKS];     // block held by each slot (-1 = none)
+    uint32_t u32LastUse[MAX_TTZ_BLOCKS];
+    uint32_t u32Clock;
+    ttIOStats_t *pStats;
+} ttTtz_t;
+
+// string prefetch (see setPrefetchBuffer); unique glyph records of a string
+// are read in offset order into a staging buffer before they are drawn
+#define MAX_PREFETCH_GLYPHS 64
+// records closer than this are read in one piece together with the bytes between them
+#define MAX_PREFETCH_GAP 256
+typedef struct {
+    uint32_t offset;    // font offset of the first byte
+    uint32_t length;
+    uint32_t bufOffset; // position in the staging buffer
+} ttPrefetch_t;
+// glyph of the string being drawn; remembered so that it isn't looked up twice
+typedef struct {
+    uint32_t code;      // character code (0xffffffff for a compound glyph component)
+    uint32_t offset;    // glyph record (0 = not looked up; the glyph is cached)
+    uint32_t length;
+    uint16_t glyphId;
+} ttPrefetchGlyph_t;
+// the staging buffer (aligned to 4) starts with the lists of the pieces and
+// glyphs; PREFETCH_BUFFER_SIZE(n) bytes stage up to n bytes of glyph records
+#define PREFETCH_TABLE_SIZE (MAX_PREFETCH_GLYPHS * (sizeof(ttPrefetch_t) + sizeof(ttPrefetchGlyph_t)))
+#define PREFETCH_BUFFER_SIZE(n) ((n) + PREFETCH_TABLE_SIZE + 3)
+
+// background prefetch; glyph records this many characters ahead (at most) are
+// read by a worker thread while the current one is drawn
+#define MAX_ASYNC_GLYPHS 16
+#ifdef BBTT_POSIX
+// Ring of upcoming glyphs with one producer (the drawing thread queues them)
+// and one consumer (the worker reads their records). The indices only grow
+// and are handed over with atomic loads/stores; the mutex and condition are
+// only used to sleep, and the other side only signals if it's asleep
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    uint8_t bRunning;
+    uint8_t bStop;
+    uint8_t bWorkerIdle;       // the worker is waiting for a glyph to be queued
+    uint8_t bDrawWaiting;      // the drawing thread is waiting for a read
+    TTFILE file;               // the worker's own position in the font
+    TTF_READ_CALLBACK *pfnRead;
+    TTF_SEEK_CALLBACK *pfnSeek;
+    uint8_t *pBuffer;          // caller supplied; one slot per ring entry
+    uint32_t u32SlotSize;
+    int iSlots;                // ring size (lookahead + 1)
+    const wchar_t *pString;    // string being drawn
+    int iNext;                 // next character of it to queue
+    ttPrefetchGlyph_t glyphs[MAX_ASYNC_GLYPHS];
+    uint8_t bRead[MAX_ASYNC_GLYPHS];  // set by the drawing thread if the record should be read
+    int32_t iRead[MAX_ASYNC_GLYPHS];  // bytes the worker read
+    uint32_t u32Queued;        // written by the drawing thread
+    uint32_t u32Done;          // written by the worker
+    uint32_t u32Used;          // glyphs the drawing thread is finished with
+} ttAsync_t;
+#endif
 typedef void(TTF_DRAWLINE)(int16_t _start_x, int16_t _start_y, int16_t _end_x, int16_t _end_y, uint32_t _colorCode);
+typedef struct {
+    int16_t y;
+    int16_t x0; // first pixel of the run
+    int16_t x1; // last pixel of the run (inclusive)
+} ttSpan_t;
+// batched fill output; a group of horizontal runs (in scanline order) sharing one color
+typedef void(TTF_DRAWSPANS)(ttSpan_t *_spans, int _count, uint32_t _colorCode);
+// cached glyph bitmap; _bpp is 1 (set bits are inside) or 4/8 (alpha), rows are _pitch bytes apart
+typedef void(TTF_DRAWBITMAP)(int16_t _x, int16_t _y, int16_t _width, int16_t _height, uint8_t _bpp, int _pitch, uint8_t *_bitmap, uint32_t _colorCode);
+// anti-aliased output; one row of _width alpha values (0-15 or 0-255) starting at _x,_y
+typedef void(TTF_DRAWALPHA)(int16_t _x, int16_t _y, int16_t _width, uint8_t *_alpha, uint32_t _colorCode);
 
 typedef struct {
     char name[5];
+    uint32_t tag;
     uint32_t checkSum;
     uint32_t offset;
     uint32_t length;
@@ -117,6 +335,72 @@ typedef struct {
     ttPoint_t points[MAX_GLYPH_POINTS];
 } ttGlyph_t;
 
+// part of a glyph record being decoded; pStart holds the bytes from u32Start
+// up to pEnd, the record's bytes end at u32End
+typedef struct {
+    const uint8_t *pStart, *pEnd;
+    uint32_t u32Start, u32End;
+} ttRecordSpan_t;
+
+// every cache entry starts with this header
+typedef struct {
+    uint32_t size;      // total size of the entry in bytes
+    uint32_t lastUsed;  // cache clock of the last access
+} ttCacheEntry_t;
+
+typedef struct {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+} ttCacheStats_t;
+
+// outline lines left out of the fill's edge table (see getOutlineStats)
+typedef struct {
+    uint32_t u32Glyphs;        // outlines filled
+    uint32_t u32Edges;         // edges left for the fill
+    uint32_t u32EdgesRemoved;  // zero length, merged and horizontal lines
+    uint16_t u16LastEdges;     // the same two counts for the last glyph
+    uint16_t u16LastRemoved;
+} ttOutlineStats_t;
+
+// LRU arena in caller supplied memory
+typedef struct {
+    uint8_t *pBuffer;
+    uint32_t u32Size;
+    uint32_t u32Used;
+    uint32_t u32Clock;
+    ttCacheStats_t stats;
+} ttCache_t;
+
+// decoded glyph in the outline cache; followed by
+// endPtsOfContours[numberOfContours] and points[numberOfPoints]
+typedef struct {
+    ttCacheEntry_t hdr;
+    uint16_t glyphId;
+    uint16_t metricsId;   // glyph providing the metrics (compound glyphs can differ)
+    uint16_t numberOfPoints;
+    int16_t numberOfContours;
+    int16_t xMin;
+    int16_t yMin;
+    int16_t xMax;
+    int16_t yMax;
+} ttGlyphCacheEntry_t;
+
+// rendered glyph in the bitmap cache; followed by height rows of pitch bytes
+typedef struct {
+    ttCacheEntry_t hdr;
+    uint16_t glyphId;
+    uint16_t metricsId;
+    uint16_t characterSize;
+    uint8_t bpp;          // 1 (hard edges), 4 or 8 (alpha)
+    uint8_t reserved;
+    int16_t xOffset;      // from the glyph origin to the left edge of the bitmap
+    int16_t yOffset;      // from the glyph origin to the top of the bitmap
+    int16_t width;
+    int16_t height;
+    uint16_t pitch;
+} ttBitmapCacheEntry_t;
+
 typedef struct {
     int16_t dx;
     int16_t dy;
@@ -153,6 +437,13 @@ typedef struct {
     uint32_t glyphIndexArrayOffset;
 } ttCmapFormat4_t;
 
+/* format 12: sorted groups of {startCharCode, endCharCode, startGlyphID} */
+typedef struct {
+    uint32_t offset;
+    uint32_t numGroups;
+    uint32_t groupsOffset;
+} ttCmapFormat12_t;
+
 /* currently only support format0 kerning tables */
 typedef struct {
     uint32_t version;  // The version number of the kerning table (0x00010000 for the current version).
@@ -176,16 +467,38 @@ typedef struct {
     int16_t y;
 } ttCoordinate_t;
 
+// characterSize / unitsPerEm in 16.16 fixed point: whole part plus a
+// remainder in 1/unitsPerEm units, so scaled points can be exact
+typedef struct {
+    int32_t q;
+    int32_t r;
+    int32_t iMax; // largest font unit co-ordinate the 16.16 maths can handle
+} ttScale_t;
+
+// text to framebuffer co-ordinates in 16.16 fixed point (see setTextTransform)
+// x' = xx * x + xy * y + tx, y' = yx * x + yy * y + ty
+typedef struct {
+    int32_t xx, xy, tx;
+    int32_t yx, yy, ty;
+} ttTransform_t;
+
 typedef struct {
     uint16_t advanceWidth;
     int16_t leftSideBearing;
 } ttHMetric_t;
 
+// scanline fill edge, stepped one row at a time with an integer DDA
+// the crossing at the current row is x + r/dy (0 <= r < dy)
 typedef struct {
-    ttCoordinate_t *p1;
-    ttCoordinate_t *p2;
-    int8_t up;
-} ttWindIntersect_t;
+    int16_t x;      // integer part of the current crossing
+    uint16_t r;     // remainder of the current crossing
+    int16_t xstep;  // floor(dx / dy)
+    uint16_t rstep; // dx - xstep * dy
+    uint16_t dy;    // height of the edge (always > 0)
+    int16_t y0;     // first row covered by the edge (y0 + dy is the first row no longer covered)
+    int8_t dir;     // +1 for upward edges, -1 for downward
+    uint8_t tie;    // 1 if a crossing exactly on a pixel edge also covers the pixel right of it
+} ttEdge_t;
 
 typedef struct {
     int16_t xAdvance; // full width of the character
@@ -200,16 +513,54 @@ typedef struct bbtt_tag {
 #ifdef ESP32
     File file;
 #endif
+    ttTtz_t ttz;                     // block compressed font state
+    TTFILE ttFile;                   // font I/O backend when pTTF is NULL
+    TTF_READ_CALLBACK *pfnRead;
+    TTF_SEEK_CALLBACK *pfnSeek;
+    TTF_CLOSE_CALLBACK *pfnClose;
     uint8_t *pTTF;                   // pointer to TTF data (not from file)
     uint32_t u32TTFSize;
     uint32_t u32TTFOffset;  // current read offset into TTF data
 
-    int iBufferedBytes;            // Number of bytes remaining in u8FileBuf
     uint8_t u8FileBuf[FILE_BUF_SIZE];  // Buffered reads from the file system
-    uint32_t u32BufPosition;           // Current position in the buffer
-    uint32_t iCurrentBufSize;
+    uint8_t *pFileBuf;                 // u8FileBuf or a caller supplied buffer
+    int iFileBufSize;                  // size of each page
+    ttPage_t pages[MAX_FILE_PAGES];    // page i is at pFileBuf[i * iFileBufSize]
+    int iPageCount;
+    int iCurPage;                      // page of the last read
+    int iMaxPinned;                    // pages that may be pinned
+    int iPinnedPages;
+    uint32_t u32PageClock;
+    uint32_t u32FilePos;               // read position; the backend is only moved on a buffer miss
+    uint8_t bReadAhead;                // load whole glyph records in one read
+    int iNextReadSize;                 // size of the next refill (0 = the whole buffer)
+    ttIOStats_t ioStats;
+    uint8_t u8GlyphBuf[GLYPH_BUF_SIZE]; // flags + coordinates of a glyph record (or a piece of it)
+    // glyph records of the string being drawn (caller supplied staging buffer)
+    uint8_t *pPrefetchBuf;
+    uint32_t u32PrefetchSize;
+    uint32_t u32PrefetchUsed;
+    ttPrefetch_t *prefetch; // staged pieces sorted by offset (in the staging buffer)
+    int iPrefetchCount;
+    ttPrefetchGlyph_t *prefetchGlyphs; // MAX_PREFETCH_GLYPHS (in the staging buffer)
+    int iPrefetchGlyphs;
+    uint32_t u32PrefetchSeek;  // distance skipped between the staging reads
+    uint32_t u32PrefetchEnd;   // end of the last staging read (0 = none yet)
+    uint32_t u32DrawSeek;      // distance between the records in drawing order
+    uint32_t u32DrawRecordEnd; // end of the last record drawn (0 = none yet)
+    uint32_t u32DrawRecords;   // records drawn from the staging buffer
+    uint32_t u32PrefetchReads; // reads made for the current string
+    // glyph being drawn as handed over by the background prefetch (code 0xffffffff = none)
+    ttPrefetchGlyph_t asyncGlyph;
+    const uint8_t *pAsyncData; // its record (NULL if the worker didn't read it)
+#ifdef BBTT_POSIX
+    ttAsync_t async;
+#endif
 
     TTF_DRAWLINE *pfnDrawLine;
+    TTF_DRAWALPHA *pfnDrawAlpha;
+    TTF_DRAWSPANS *pfnDrawSpans;
+    TTF_DRAWBITMAP *pfnDrawBitmap;
 
     uint16_t charCode;
     int16_t xMin, xMax, yMin, yMax;
@@ -220,8 +571,29 @@ typedef struct bbtt_tag {
     ttCmapIndex_t cmapIndex;
     ttCmapEncoding_t *cmapEncoding;
     ttCmapFormat4_t cmapFormat4;
+    ttCmapFormat12_t cmapFormat12; // full repertoire (codes beyond the BMP)
+    // optional dense code->glyph table for a range of codes (caller supplied memory)
+    uint16_t *pGlyphTable;
+    uint16_t u16TableFirst;
+    uint16_t u16TableLast;
+    // index tables preloaded in native byte order (caller supplied memory); a table
+    // that didn't fit is read from the font as before
+    uint8_t *pIndexBuf;
+    uint32_t u32IndexSize;
+    uint32_t u32IndexUsed;
+    uint8_t u8IndexTables;    // TT_INDEX_xxx flags of the preloaded tables
+    uint16_t *pCmap4;         // format 4 words from endCode[0] on
+    uint32_t u32Cmap4Words;
+    uint32_t *pCmap12;        // format 12 groups (3 values each)
+    uint16_t *pLocaShort;     // loca as stored in the font (short or long format)
+    uint32_t *pLocaLong;
+    uint32_t u32LocaCount;
+    ttHMetric_t *pHMetrics;   // numOfLongHorMetrics entries
     ttGlyphTransformation_t glyphTransformation;
     uint32_t hmtxTablePos;
+    // resolved when the table directory is read; used for every glyph
+    uint32_t locaTablePos;
+    uint32_t glyfTablePos;
     // kerning.
     ttKernHeader_t kernHeader;
     ttKernSubtable_t kernSubtable;
@@ -236,9 +608,25 @@ typedef struct bbtt_tag {
     uint16_t numBeginPoints;
     uint16_t endPoints[MAX_ENDPOINTS];
     uint16_t numEndPoints;
+    ttOutlineStats_t outlineStats;
+    // scanline fill
+    ttEdge_t edges[MAX_EDGES];
+    uint16_t activeEdges[MAX_EDGES];
+    int16_t edgeTop, edgeBottom; // rows of outline units the table is built for
+    int32_t edgeTol;             // tolerance the outline's lines were merged with (0 if not)
+    ttSpan_t spans[MAX_SPANS];
+    uint16_t numSpans;
+    // anti-aliased fill (caller supplied memory)
+    int32_t *aaAccum;         // aaWidth + 2 coverage sums
+    uint8_t *aaRow;           // aaWidth alpha values
+    int16_t aaWidth;
 
     // glyf
     ttGlyph_t glyph;
+    // decoded outline and rendered bitmap caches (caller supplied memory)
+    ttCache_t glyphCache;
+    ttCache_t bitmapCache;
+    ttBitmapCacheEntry_t *pCapture; // bitmap being rendered into the cache
     // write user framebuffer
     uint8_t *userFrameBuffer;
     uint16_t characterSize;
@@ -251,12 +639,30 @@ typedef struct bbtt_tag {
     uint16_t displayWidthFrame;
     uint16_t framebufferBit;
     uint8_t stringRotation;
+    // the transform is applied to the outline of each glyph; the text
+    // boundary is transformed into the framebuffer area that clips it
+    ttTransform_t transform;
+    uint8_t transformType;    // TRANSFORM_xxx
+    int32_t transformScale;   // most it stretches a line (16.16), for the curve steps
+    int16_t clipX1, clipY1;   // framebuffer area of the text boundary
+    int16_t clipX2, clipY2;   // (exclusive)
     uint32_t colorLine;
     uint32_t colorInside;
     uint8_t kerningOn;
     uint8_t bBigEndian;
     uint8_t textAlign;
+    uint8_t antialias;        // TEXT_AA_xxx in use (none without an antialias buffer)
+    uint8_t antialiasMode;    // as set by setTextAntialias
+    uint8_t curveTolerance;
     uint8_t lastError;
+    // lazy open (see setLazyOpen) and the table checksums (see checkFont)
+    uint8_t bLazyOpen;
+    uint8_t bTablesPending;  // only the table directory has been read so far
+    uint8_t bCheckSum;       // the checksums must match before the font is used
+    int8_t iCheckState;      // TT_CHECK_xxx
+    int iCheckTable;         // table being checked
+    uint32_t u32CheckPos;    // bytes of it summed so far
+    uint32_t u32CheckSum;
 } BBTT;
 
 const int numTablesPos = 4;
@@ -265,20 +671,52 @@ const int tablePos = 12;
 class bb_truetype {
    public:
     bb_truetype();
+#ifdef BBTT_POSIX
+    ~bb_truetype();
+#endif
 
 #ifdef ESP32
     uint8_t setTtfFile(File _file, uint8_t _checkCheckSum = 0);
 #endif
     uint8_t setTtfPointer(uint8_t *pTTF, uint32_t u32Size, uint8_t _checkCheckSum = 0);
+    uint8_t setTtfCallbacks(void *fHandle, int32_t iSize, TTF_READ_CALLBACK *pfnRead, TTF_SEEK_CALLBACK *pfnSeek, TTF_CLOSE_CALLBACK *pfnClose, uint8_t _checkCheckSum = 0);
+    uint8_t setTtzPointer(const uint8_t *pData, uint32_t u32Size, uint8_t *pCache, uint32_t u32CacheSize, uint8_t _checkCheckSum = 0);
+#ifdef BBTT_POSIX
+    uint8_t openTtfFile(const char *szName, uint8_t _checkCheckSum = 0);
+    uint8_t mapTtfFile(const char *szName, uint8_t _checkCheckSum = 0);
+    uint8_t setAsyncPrefetch(uint8_t *pBuffer, uint32_t u32Size, int iLookahead = 4);
+#endif
     void setTtfDrawLine(TTF_DRAWLINE *p);
+    void setTtfDrawAlpha(TTF_DRAWALPHA *p);
+    void setTtfDrawSpans(TTF_DRAWSPANS *p);
+    void setTtfDrawBitmap(TTF_DRAWBITMAP *p);
     void setFramebuffer(uint16_t _framebufferWidth, uint16_t _framebufferHeight, uint16_t _framebuffer_bit, uint8_t *_framebuffer);
     void setCharacterSpacing(int16_t _characterSpace, uint8_t _kerning = 1);
     void setCharacterSize(uint16_t _characterSize);
     void setTextBoundary(uint16_t _start_x, uint16_t _end_x, uint16_t _end_y);
     void setTextColor(uint32_t _onLine, uint32_t _inside);
+    void setTextAntialias(uint8_t _mode);
+    void setAntialiasBuffer(uint8_t *pBuffer, uint32_t u32Size);
+    void setCurveTolerance(uint8_t _tolerance);
     void setTextRotation(uint16_t _rotation);
-    void getCharBox(wchar_t _c, ttCharBox_t *pBox);
+    void setTextTransform(int32_t xx, int32_t xy, int32_t tx, int32_t yx, int32_t yy, int32_t ty);
+    void setTextAngle(int16_t iDegrees, int16_t _x, int16_t _y);
+    void getCharBox(uint32_t _c, ttCharBox_t *pBox);
     void setTextAlignment(uint8_t _alignment);
+    void setGlyphTable(uint16_t *pTable, uint16_t u16First, uint16_t u16Last);
+    void setGlyphCache(uint8_t *pBuffer, uint32_t u32Size);
+    void getGlyphCacheStats(ttCacheStats_t *pStats);
+    void setBitmapCache(uint8_t *pBuffer, uint32_t u32Size);
+    void getBitmapCacheStats(ttCacheStats_t *pStats);
+    void setFileBuffer(uint8_t *pBuffer, int iSize, uint8_t bReadAhead = 0);
+    uint8_t setPageCache(uint8_t *pBuffer, uint32_t u32Size, int iPageSize, int iPinned = 0, uint8_t bReadAhead = 0);
+    void getIOStats(ttIOStats_t *pStats);
+    void getOutlineStats(ttOutlineStats_t *pStats);
+    void setPrefetchBuffer(uint8_t *pBuffer, uint32_t u32Size);
+    void setIndexBuffer(uint8_t *pBuffer, uint32_t u32Size);
+    uint8_t getIndexTables(uint32_t *pUsed = NULL);
+    void setLazyOpen(uint8_t bLazy);
+    int checkFont(uint32_t u32MaxBytes = 0);
     uint16_t getStringWidth(const wchar_t *szwString);
     uint16_t getStringWidth(const char *szString);
 #ifdef ARDUINO
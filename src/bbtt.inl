@@ -31,75 +31,431 @@
  * THE SOFTWARE.
  */
 
+uint8_t bbttFontReady(BBTT *pBBTT); // finishes a lazy open (see bbttLoadFont)
+
+//
+// Forget the preloaded index tables (the buffer itself is kept)
+//
+void bbttClearIndex(BBTT *pBBTT)
+{
+    pBBTT->u32IndexUsed = 0;
+    pBBTT->u8IndexTables = 0;
+    pBBTT->pCmap4 = NULL;
+    pBBTT->u32Cmap4Words = 0;
+    pBBTT->pCmap12 = NULL;
+    pBBTT->pLocaShort = NULL;
+    pBBTT->pLocaLong = NULL;
+    pBBTT->u32LocaCount = 0;
+    pBBTT->pHMetrics = NULL;
+} /* bbttClearIndex() */
+
+//
+// Forget the contents of the read buffer pages (new font or buffer)
+//
+void bbttClearPages(BBTT *pBBTT)
+{
+    memset(pBBTT->pages, 0, sizeof(pBBTT->pages));
+    pBBTT->iCurPage = 0;
+    pBBTT->iPinnedPages = 0;
+    pBBTT->u32PageClock = 0;
+    pBBTT->iNextReadSize = 0;
+} /* bbttClearPages() */
+
 void bbttInit(BBTT *pBBTT)
 {
     pBBTT->numPoints = pBBTT->numBeginPoints = pBBTT->numEndPoints = 0;
     pBBTT->bBigEndian = 0;
     pBBTT->stringRotation = 0;
+    memset(&pBBTT->transform, 0, sizeof(ttTransform_t));
+    pBBTT->transform.xx = pBBTT->transform.yy = 65536;
+    pBBTT->transformType = TRANSFORM_NONE;
+    pBBTT->transformScale = 65536;
+    pBBTT->clipX1 = pBBTT->clipY1 = pBBTT->clipX2 = pBBTT->clipY2 = 0;
     pBBTT->characterSpace = 0;
     pBBTT->kerningOn = 1;
     pBBTT->kernTablePos = 0;
     pBBTT->ascender = 0;
-    pBBTT->iBufferedBytes = 0;
+    pBBTT->headTable.unitsPerEm = 0; // no font yet
+    pBBTT->pFileBuf = pBBTT->u8FileBuf;
+    pBBTT->iFileBufSize = FILE_BUF_SIZE;
+    pBBTT->iPageCount = 1;
+    pBBTT->iMaxPinned = 0;
+    bbttClearPages(pBBTT);
+    pBBTT->u32FilePos = 0;
+    pBBTT->bReadAhead = 0;
+    memset(&pBBTT->ioStats, 0, sizeof(ttIOStats_t));
+    memset(&pBBTT->outlineStats, 0, sizeof(ttOutlineStats_t));
     pBBTT->hmtxTablePos = 0;
+    pBBTT->locaTablePos = pBBTT->glyfTablePos = 0;
     pBBTT->u32TTFSize = pBBTT->u32TTFOffset = 0;
     pBBTT->pTTF = NULL;
+    memset(&pBBTT->ttFile, 0, sizeof(TTFILE));
+    memset(&pBBTT->ttz, 0, sizeof(ttTtz_t));
+    pBBTT->pfnRead = NULL;
+    pBBTT->pfnSeek = NULL;
+    pBBTT->pfnClose = NULL;
     pBBTT->pfnDrawLine = NULL;
-    pBBTT->iCurrentBufSize = 0;
+    pBBTT->pfnDrawAlpha = NULL;
+    pBBTT->pfnDrawSpans = NULL;
+    pBBTT->numSpans = 0;
+    pBBTT->antialias = pBBTT->antialiasMode = TEXT_AA_NONE;
+    pBBTT->aaAccum = NULL;
+    pBBTT->aaRow = NULL;
+    pBBTT->aaWidth = 0;
+    pBBTT->curveTolerance = CURVE_TOLERANCE;
     pBBTT->textAlign = TEXT_ALIGN_LEFT;
+    pBBTT->pfnDrawBitmap = NULL;
+    pBBTT->pGlyphTable = NULL;
+    pBBTT->u16TableFirst = pBBTT->u16TableLast = 0;
+    pBBTT->cmapFormat4.segCountX2 = 0;
+    pBBTT->cmapFormat12.numGroups = 0;
+    pBBTT->pPrefetchBuf = NULL;
+    pBBTT->prefetch = NULL;
+    pBBTT->prefetchGlyphs = NULL;
+    pBBTT->u32PrefetchSize = 0;
+    pBBTT->iPrefetchCount = pBBTT->iPrefetchGlyphs = 0;
+    pBBTT->asyncGlyph.code = 0xffffffff;
+    pBBTT->pAsyncData = NULL;
+#ifdef BBTT_POSIX
+    memset(&pBBTT->async, 0, sizeof(ttAsync_t));
+#endif
+    pBBTT->pIndexBuf = NULL;
+    pBBTT->u32IndexSize = 0;
+    bbttClearIndex(pBBTT);
+    memset(&pBBTT->glyphCache, 0, sizeof(ttCache_t));
+    memset(&pBBTT->bitmapCache, 0, sizeof(ttCache_t));
+    pBBTT->pCapture = NULL;
+    pBBTT->bLazyOpen = pBBTT->bTablesPending = 0;
+    pBBTT->bCheckSum = 0;
+    pBBTT->iCheckState = TT_CHECK_PENDING;
+    pBBTT->iCheckTable = 0;
+    pBBTT->u32CheckPos = pBBTT->u32CheckSum = 0;
 } /* bbttInit() */
 
+//
+// Framebuffer area that the text boundary covers once it's transformed
+// (its bounding box for a rotation that isn't a quadrant); everything
+// drawn is clipped to it
+//
+void bbttSetClip(BBTT *pBBTT)
+{
+    int32_t x1 = pBBTT->start_x, y1 = 0, x2 = pBBTT->end_x, y2 = pBBTT->end_y;
+
+    if (pBBTT->transformType != TRANSFORM_NONE) {
+        const ttTransform_t *t = &pBBTT->transform;
+        int64_t xMin = INT64_MAX, yMin = INT64_MAX, xMax = INT64_MIN, yMax = INT64_MIN;
+        for (int i = 0; i < 4; i++) { // the corners
+            int32_t cx = (i & 1) ? pBBTT->end_x : pBBTT->start_x;
+            int32_t cy = (i & 2) ? pBBTT->end_y : 0;
+            int64_t x = (int64_t)t->xx * cx + (int64_t)t->xy * cy + t->tx;
+            int64_t y = (int64_t)t->yx * cx + (int64_t)t->yy * cy + t->ty;
+            if (x < xMin) xMin = x;
+            if (x > xMax) xMax = x;
+            if (y < yMin) yMin = y;
+            if (y > yMax) yMax = y;
+        }
+        x1 = (int32_t)(xMin >> 16);
+        y1 = (int32_t)(yMin >> 16);
+        x2 = (int32_t)((xMax + 0xffff) >> 16);
+        y2 = (int32_t)((yMax + 0xffff) >> 16);
+    }
+    pBBTT->clipX1 = (x1 < 0) ? 0 : (x1 > pBBTT->displayWidth) ? pBBTT->displayWidth : x1;
+    pBBTT->clipX2 = (x2 < 0) ? 0 : (x2 > pBBTT->displayWidth) ? pBBTT->displayWidth : x2;
+    pBBTT->clipY1 = (y1 < 0) ? 0 : (y1 > pBBTT->displayHeight) ? pBBTT->displayHeight : y1;
+    pBBTT->clipY2 = (y2 < 0) ? 0 : (y2 > pBBTT->displayHeight) ? pBBTT->displayHeight : y2;
+} /* bbttSetClip() */
+
+//
+// Set the transform from text to framebuffer co-ordinates (16.16 fixed point,
+// see ttTransform_t). It is applied to the outline of each glyph, so any
+// rotation, skew or scale costs nothing per pixel and the callbacks get
+// transformed co-ordinates too
+//
+void bbttSetTransform(BBTT *pBBTT, const ttTransform_t *pTransform)
+{
+    ttTransform_t *t = &pBBTT->transform;
+    int64_t i64Row0, i64Row1;
+
+    if (pTransform->xx != t->xx || pTransform->xy != t->xy || pTransform->yx != t->yx || pTransform->yy != t->yy) {
+        pBBTT->bitmapCache.u32Used = 0; // cached glyphs were transformed differently
+    }
+    *t = *pTransform;
+    if (t->xx == 65536 && t->xy == 0 && t->tx == 0 && t->yx == 0 && t->yy == 65536 && t->ty == 0) {
+        pBBTT->transformType = TRANSFORM_NONE;
+    } else if (((t->xx | t->xy | t->tx | t->yx | t->yy | t->ty) & 0xffff) == 0) {
+        // a quarter turn or flip takes each axis to one axis, unscaled
+        uint8_t bSwap = (t->xx == 0 && t->yy == 0);
+        int32_t a = (bSwap) ? t->xy : (t->xy == 0 && t->yx == 0) ? t->xx : 0;
+        int32_t d = (bSwap) ? t->yx : t->yy;
+        pBBTT->transformType = ((a == 65536 || a == -65536) && (d == 65536 || d == -65536)) ? TRANSFORM_QUARTER : TRANSFORM_WHOLE;
+    } else {
+        pBBTT->transformType = TRANSFORM_ANY;
+    }
+    i64Row0 = ((t->xx < 0) ? -(int64_t)t->xx : t->xx) + ((t->xy < 0) ? -(int64_t)t->xy : t->xy);
+    i64Row1 = ((t->yx < 0) ? -(int64_t)t->yx : t->yx) + ((t->yy < 0) ? -(int64_t)t->yy : t->yy);
+    if (i64Row1 > i64Row0) i64Row0 = i64Row1;
+    pBBTT->transformScale = (i64Row0 > INT32_MAX) ? INT32_MAX : (int32_t)i64Row0;
+    pBBTT->stringRotation = 0;
+    bbttSetClip(pBBTT);
+} /* bbttSetTransform() */
+
+//
+// The quadrant rotations are transforms which turn the framebuffer under the
+// text; they're set again when the framebuffer size changes
+//
 void bbttSetRotation(BBTT *pBBTT, uint16_t _rotation)
 {
+    ttTransform_t t = {65536, 0, 0, 0, 65536, 0};
+    int32_t w = (int32_t)pBBTT->displayWidth << 16, h = (int32_t)pBBTT->displayHeight << 16;
+
     switch (_rotation) {
         case ROTATE_90:
-        case 90:
+        case 90: // x' = w - y, y' = x
             _rotation = 1;
+            t.xx = 0; t.xy = -65536; t.tx = w;
+            t.yx = 65536; t.yy = 0;
             break;
         case ROTATE_180:
-        case 180:
+        case 180: // x' = w - x, y' = h - y
             _rotation = 2;
+            t.xx = -65536; t.tx = w;
+            t.yy = -65536; t.ty = h;
             break;
         case ROTATE_270:
-        case 270:
+        case 270: // x' = y, y' = h - x
             _rotation = 3;
+            t.xx = 0; t.xy = 65536;
+            t.yx = -65536; t.yy = 0; t.ty = h;
             break;
         default:
             _rotation = 0;
             break;
     }
+    bbttSetTransform(pBBTT, &t);
     pBBTT->stringRotation = _rotation;
 } /* bbttSetRotation() */
 
+// sin(0..90 degrees) in 16.16
+const int32_t bbttSinTable[91] = {
+    0, 1144, 2287, 3430, 4572, 5712, 6850, 7987, 9121, 10252,
+    11380, 12505, 13626, 14742, 15855, 16962, 18064, 19161, 20252, 21336,
+    22415, 23486, 24550, 25607, 26656, 27697, 28729, 29753, 30767, 31772,
+    32768, 33754, 34729, 35693, 36647, 37590, 38521, 39441, 40348, 41243,
+    42126, 42995, 43852, 44695, 45525, 46341, 47143, 47930, 48703, 49461,
+    50203, 50931, 51643, 52339, 53020, 53684, 54332, 54963, 55578, 56175,
+    56756, 57319, 57865, 58393, 58903, 59396, 59870, 60326, 60764, 61183,
+    61584, 61966, 62328, 62672, 62997, 63303, 63589, 63856, 64104, 64332,
+    64540, 64729, 64898, 65048, 65177, 65287, 65376, 65446, 65496, 65526,
+    65536};
+
+// sine of 0-359 degrees in 16.16
+int32_t bbttSin16(int32_t iDegrees)
+{
+    if (iDegrees <= 90) return bbttSinTable[iDegrees];
+    if (iDegrees <= 180) return bbttSinTable[180 - iDegrees];
+    if (iDegrees <= 270) return -bbttSinTable[iDegrees - 180];
+    return -bbttSinTable[360 - iDegrees];
+} /* bbttSin16() */
+
+//
+// Turn the text clockwise by iDegrees about the text position _x, _y
+//
+void bbttSetTextAngle(BBTT *pBBTT, int16_t iDegrees, int16_t _x, int16_t _y)
+{
+    int32_t a = iDegrees % 360, s, c;
+    ttTransform_t t;
+
+    if (a < 0) a += 360;
+    s = bbttSin16(a);
+    c = bbttSin16((a + 90) % 360);
+    t.xx = c; t.xy = -s;
+    t.yx = s; t.yy = c;
+    // keep _x, _y where it is
+    t.tx = (int32_t)((int64_t)_x * 65536 - (int64_t)c * _x + (int64_t)s * _y);
+    t.ty = (int32_t)((int64_t)_y * 65536 - (int64_t)s * _x - (int64_t)c * _y);
+    bbttSetTransform(pBBTT, &t);
+} /* bbttSetTextAngle() */
+
 void bbttSetTextColor(BBTT *pBBTT, uint32_t _onLine, uint32_t _inside)
 {
     pBBTT->colorLine = _onLine;
     pBBTT->colorInside = _inside;
 } /* bbttSetTextColor() */
 
+//
+// The anti-aliased fill needs the antialias buffer (see bbttSetAntialiasBuffer);
+// without one the text is drawn with the 1-bit fill
+//
+void bbttSetTextAntialias(BBTT *pBBTT, uint8_t _mode)
+{
+    if (_mode != TEXT_AA_4BIT && _mode != TEXT_AA_8BIT) {
+        _mode = TEXT_AA_NONE;
+    }
+    pBBTT->antialiasMode = _mode;
+    pBBTT->antialias = (pBBTT->aaWidth) ? _mode : TEXT_AA_NONE;
+} /* bbttSetTextAntialias() */
+
+//
+// Give the library memory for the rows of the anti-aliased fill;
+// AA_BUFFER_SIZE(w) bytes fill glyph boxes up to w pixels wide. NULL turns
+// anti-aliasing off until another buffer is set
+//
+void bbttSetAntialiasBuffer(BBTT *pBBTT, uint8_t *pBuffer, uint32_t u32Size)
+{
+    uint32_t u32Align = (pBuffer) ? ((0 - (uintptr_t)pBuffer) & 3) : 0;
+    int32_t iWidth = (pBuffer && u32Size > u32Align + 8) ? (int32_t)(u32Size - u32Align - 8) / 5 : 0;
+
+    if (iWidth > INT16_MAX) iWidth = INT16_MAX;
+    pBBTT->aaWidth = (int16_t)iWidth;
+    pBBTT->aaAccum = (iWidth) ? (int32_t *)&pBuffer[u32Align] : NULL;
+    pBBTT->aaRow = (iWidth) ? (uint8_t *)&pBBTT->aaAccum[iWidth + 2] : NULL;
+    bbttSetTextAntialias(pBBTT, pBBTT->antialiasMode);
+} /* bbttSetAntialiasBuffer() */
+
+//
+// Largest distance (in 1/16ths of a pixel) between a curve and the line
+// segments that replace it, and the starting point when an outline with too
+// many edges is merged (see bbttBuildEdges); smaller is smoother but gives
+// the fill more edges
+//
+void bbttSetCurveTolerance(BBTT *pBBTT, uint8_t _tolerance)
+{
+    if (_tolerance == 0) {
+        _tolerance = 1;
+    }
+    if (_tolerance != pBBTT->curveTolerance) {
+        pBBTT->bitmapCache.u32Used = 0; // cached glyphs were flattened differently
+        pBBTT->curveTolerance = _tolerance;
+    }
+} /* bbttSetCurveTolerance() */
+
+/* return the page holding u32Len bytes at u32Offset or -1 */
+int bbttFindPage(BBTT *pBBTT, uint32_t u32Offset, uint32_t u32Len)
+{
+    ttPage_t *pPage = &pBBTT->pages[pBBTT->iCurPage];
+    int i;
+
+    // the last page used is the likely one
+    if (u32Offset - pPage->u32Start < (uint32_t)pPage->iSize && u32Len <= (uint32_t)pPage->iSize - (u32Offset - pPage->u32Start)) {
+        return pBBTT->iCurPage;
+    }
+    for (i = 0; i < pBBTT->iPageCount; i++) {
+        pPage = &pBBTT->pages[i];
+        if (u32Offset - pPage->u32Start < (uint32_t)pPage->iSize && u32Len <= (uint32_t)pPage->iSize - (u32Offset - pPage->u32Start)) {
+            return i;
+        }
+    }
+    return -1;
+} /* bbttFindPage() */
+
+/* is u32Offset in the cmap segments/groups or loca data that every character looks up? */
+int bbttIsHotSpot(BBTT *pBBTT, uint32_t u32Offset)
+{
+    if (pBBTT->cmapFormat4.segCountX2 && u32Offset >= pBBTT->cmapFormat4.endCodeOffset && u32Offset < pBBTT->cmapFormat4.glyphIndexArrayOffset) {
+        return 1;
+    }
+    if (pBBTT->cmapFormat12.numGroups && u32Offset - pBBTT->cmapFormat12.groupsOffset < pBBTT->cmapFormat12.numGroups * 12) {
+        return 1;
+    }
+    for (int i = 0; i < pBBTT->numTables; i++) {
+        if (pBBTT->table[i].tag == TT_TAG('l','o','c','a')) {
+            return (u32Offset - pBBTT->table[i].offset < pBBTT->table[i].length);
+        }
+    }
+    return 0;
+} /* bbttIsHotSpot() */
+
+//
+// Pick the page to load u32Offset into: the least recently used one that isn't pinned
+//
+int bbttNewPage(BBTT *pBBTT)
+{
+    int i, iPage = -1;
+
+    for (i = 0; i < pBBTT->iPageCount; i++) {
+        if (!pBBTT->pages[i].bPinned && (iPage < 0 || pBBTT->pages[i].u32LastUse < pBBTT->pages[iPage].u32LastUse)) {
+            iPage = i;
+        }
+    }
+    pBBTT->pages[iPage].u16Hits = 0;
+    pBBTT->ioStats.u32PageMisses++;
+    return iPage;
+} /* bbttNewPage() */
+
+//
+// Note a read from a page that was already loaded. While pins are left, a
+// page of cmap/loca data that keeps being used is pinned
+//
+void bbttPageHit(BBTT *pBBTT, int iPage)
+{
+    ttPage_t *pPage = &pBBTT->pages[iPage];
+
+    pBBTT->ioStats.u32PageHits++;
+    if (++pPage->u16Hits == PAGE_PIN_HITS && !pPage->bPinned && pBBTT->iPinnedPages < pBBTT->iMaxPinned && bbttIsHotSpot(pBBTT, pPage->u32Start)) {
+        pPage->bPinned = 1;
+        pBBTT->iPinnedPages++;
+    }
+} /* bbttPageHit() */
+
 int bbttRead(BBTT *pBBTT, uint8_t *d, int iLen) {
     if (!pBBTT->pTTF) {
-        //return file.read(d, iLen);
         int totalBytesRead = 0;
-#ifdef ESP32
+        if (!pBBTT->pfnRead) {
+            return 0;
+        }
         while (iLen > 0) {
-            if (pBBTT->iBufferedBytes == 0) {
-                pBBTT->iBufferedBytes = pBBTT->file.read(pBBTT->u8FileBuf, FILE_BUF_SIZE);
-                pBBTT->iCurrentBufSize = pBBTT->iBufferedBytes;
-                if (pBBTT->iBufferedBytes <= 0) break;
-                pBBTT->u32BufPosition = 0;
+            int iPage = (pBBTT->iNextReadSize) ? -1 : bbttFindPage(pBBTT, pBBTT->u32FilePos, 1);
+            if (iPage < 0) {
+                // load a page at the current position; only seek the backend if it's elsewhere
+                if ((uint32_t)pBBTT->ttFile.iPos != pBBTT->u32FilePos) {
+                    (*pBBTT->pfnSeek)(&pBBTT->ttFile, (int32_t)pBBTT->u32FilePos);
+                    pBBTT->ioStats.u32Seeks++;
+                }
+                if (iLen >= pBBTT->iFileBufSize && pBBTT->iNextReadSize == 0) {
+                    // too big for a page (e.g. preloading a table); read it in place
+                    int iBytes = (*pBBTT->pfnRead)(&pBBTT->ttFile, d, iLen);
+                    pBBTT->ioStats.u32Reads++;
+                    if (iBytes <= 0) {
+                        break;
+                    }
+                    pBBTT->ioStats.u32BytesRead += iBytes;
+                    d += iBytes;
+                    iLen -= iBytes;
+                    pBBTT->u32FilePos += iBytes;
+                    totalBytesRead += iBytes;
+                    continue;
+                }
+                int iReadSize = pBBTT->iFileBufSize;
+                if (pBBTT->iNextReadSize > iLen) { // a glyph record (see bbttSeekRecord)
+                    iReadSize = pBBTT->iNextReadSize;
+                }
+                pBBTT->iNextReadSize = 0;
+                iPage = bbttNewPage(pBBTT);
+                ttPage_t *pPage = &pBBTT->pages[iPage];
+                pPage->u32Start = pBBTT->u32FilePos;
+                pPage->iSize = (*pBBTT->pfnRead)(&pBBTT->ttFile, &pBBTT->pFileBuf[iPage * pBBTT->iFileBufSize], iReadSize);
+                pBBTT->ioStats.u32Reads++;
+                if (pPage->iSize <= 0) {
+                    pPage->iSize = 0;
+                    break;
+                }
+                pBBTT->ioStats.u32BytesRead += pPage->iSize;
+            } else {
+                bbttPageHit(pBBTT, iPage);
             }
-
-            int bytesToCopy = min(iLen, pBBTT->iBufferedBytes);
-            memcpy(d, pBBTT->u8FileBuf + pBBTT->u32BufPosition, bytesToCopy);
+            ttPage_t *pPage = &pBBTT->pages[iPage];
+            pPage->u32LastUse = ++pBBTT->u32PageClock;
+            pBBTT->iCurPage = iPage;
+            int iOffset = (int)(pBBTT->u32FilePos - pPage->u32Start);
+            int bytesToCopy = pPage->iSize - iOffset;
+            if (bytesToCopy > iLen) bytesToCopy = iLen;
+            memcpy(d, &pBBTT->pFileBuf[iPage * pBBTT->iFileBufSize + iOffset], bytesToCopy);
 
             d += bytesToCopy;
             iLen -= bytesToCopy;
-            pBBTT->iBufferedBytes -= bytesToCopy;
-            pBBTT->u32BufPosition += bytesToCopy;
+            pBBTT->u32FilePos += bytesToCopy;
             totalBytesRead += bytesToCopy;
         }
-#endif // ESP32
         return totalBytesRead;
     } else {
 
@@ -113,9 +469,16 @@ int bbttRead(BBTT *pBBTT, uint8_t *d, int iLen) {
     return 0;
 } /* bbttRead() */
 
+//
+// The getters decode in-memory fonts directly from pTTF; only reads that
+// would run off the end (and file fonts) go through bbttRead
+//
 uint8_t bbttGetUInt8t(BBTT *pBBTT)
 {
     uint8_t x;
+    if (pBBTT->pTTF && pBBTT->u32TTFOffset < pBBTT->u32TTFSize) {
+        return pBBTT->pTTF[pBBTT->u32TTFOffset++];
+    }
     bbttRead(pBBTT, &x, 1);
     return x;
 } /* bbttGetUInt8t */
@@ -123,39 +486,39 @@ uint8_t bbttGetUInt8t(BBTT *pBBTT)
 uint16_t bbttGetUInt16t(BBTT *pBBTT)
 {
     uint16_t x;
+    if (pBBTT->pTTF && pBBTT->u32TTFOffset + 2 <= pBBTT->u32TTFSize) {
+        x = TT_U16(&pBBTT->pTTF[pBBTT->u32TTFOffset]);
+        pBBTT->u32TTFOffset += 2;
+        return x;
+    }
     bbttRead(pBBTT, (uint8_t *)&x, 2);
     return __builtin_bswap16(x);
 } /* bbttGetUInt16t */
 
 int16_t bbttGetInt16t(BBTT *pBBTT)
 {
-    int16_t x;
-    bbttRead(pBBTT, (uint8_t *)&x, 2);
-    return __builtin_bswap16(x);
+    return (int16_t)bbttGetUInt16t(pBBTT);
 } /* bbttGetInt16t */
 
 uint32_t bbttGetUInt32t(BBTT *pBBTT) {
     uint32_t x;
+    if (pBBTT->pTTF && pBBTT->u32TTFOffset + 4 <= pBBTT->u32TTFSize) {
+        x = TT_U32(&pBBTT->pTTF[pBBTT->u32TTFOffset]);
+        pBBTT->u32TTFOffset += 4;
+        return x;
+    }
     bbttRead(pBBTT, (uint8_t *)&x, 4);
     return __builtin_bswap32(x);
 } /* bbttGetUInt32t() */
 
 void bbttSeek(BBTT *pBBTT, uint32_t u32Offset) {
     if (!pBBTT->pTTF) {
-        /*
-        TODO/FIXME: for some reason this doesn't work.
-        If a seek position is within the current loaded buffer, it should just change the buffer position
-
-        if (u32Offset >= file.position() - iCurrentBufSize && u32Offset < file.position()) {
-            u32BufPosition = u32Offset - (file.position() - iCurrentBufSize);
-            iBufferedBytes = file.position() - u32Offset;
-        } else {
-        */
-#ifdef ESP32
-        pBBTT->file.seek(u32Offset);
-#endif
-        pBBTT->iBufferedBytes = 0;
-        // }
+        // just move the read position; bbttRead serves it from the buffer
+        // or seeks the backend when the buffer doesn't hold it
+        if (bbttFindPage(pBBTT, u32Offset, 1) >= 0) {
+            pBBTT->ioStats.u32BufferedSeeks++;
+        }
+        pBBTT->u32FilePos = u32Offset;
     } else {
         if (u32Offset > pBBTT->u32TTFSize) {
             u32Offset = pBBTT->u32TTFSize;
@@ -164,56 +527,334 @@ void bbttSeek(BBTT *pBBTT, uint32_t u32Offset) {
     }
 } /* bbttSeek() */
 
-/* calculate checksum */
-uint32_t bbttCalculateCheckSum(BBTT *pBBTT, uint32_t offset, uint32_t length) {
-    uint32_t checksum = 0L;
+//
+// Return a pointer to the staged copy of u32Len bytes at u32Offset (see
+// bbttPrefetchString) or NULL if no staged piece holds all of them
+//
+const uint8_t *bbttFindPrefetch(BBTT *pBBTT, uint32_t u32Offset, uint32_t u32Len)
+{
+    int lo = 0, hi = pBBTT->iPrefetchCount - 1, mid;
+    ttPrefetch_t *pPiece;
+
+    if (hi < 0) {
+        return NULL;
+    }
+    while (lo < hi) { // last piece starting at or before u32Offset
+        mid = (lo + hi + 1) / 2;
+        if (pBBTT->prefetch[mid].offset <= u32Offset) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    pPiece = &pBBTT->prefetch[lo];
+    if (u32Offset < pPiece->offset || u32Offset - pPiece->offset > pPiece->length || u32Len > pPiece->length - (u32Offset - pPiece->offset)) {
+        return NULL;
+    }
+    return &pBBTT->pPrefetchBuf[pPiece->bufOffset + (u32Offset - pPiece->offset)];
+} /* bbttFindPrefetch() */
+
+//
+// Return a pointer to iLen bytes of the font starting at u32Offset if they can
+// be used where they are: an in-memory font that holds the whole record
+// (zero-copy, one bounds check for the record), or a file font whose read
+// buffer or the string prefetch holds it. Leaves the read position after the
+// record. Returns NULL if the bytes would have to be read
+//
+const uint8_t *bbttPeekRecord(BBTT *pBBTT, uint32_t u32Offset, int iLen)
+{
+    if (pBBTT->pTTF) {
+        if (u32Offset <= pBBTT->u32TTFSize && (uint32_t)iLen <= pBBTT->u32TTFSize - u32Offset) {
+            pBBTT->u32TTFOffset = u32Offset + iLen;
+            return &pBBTT->pTTF[u32Offset];
+        }
+    } else {
+        const uint8_t *p = (pBBTT->iPrefetchCount) ? bbttFindPrefetch(pBBTT, u32Offset, iLen) : NULL;
+        if (pBBTT->pAsyncData && u32Offset >= pBBTT->asyncGlyph.offset && u32Offset + iLen <= pBBTT->asyncGlyph.offset + pBBTT->asyncGlyph.length) {
+            p = &pBBTT->pAsyncData[u32Offset - pBBTT->asyncGlyph.offset]; // read by the worker thread
+        }
+        if (p) {
+            pBBTT->u32FilePos = u32Offset + iLen;
+            return p;
+        }
+        int iPage = bbttFindPage(pBBTT, u32Offset, iLen);
+        if (iPage >= 0) { // already in the file buffer
+            ttPage_t *pPage = &pBBTT->pages[iPage];
+            pPage->u32LastUse = ++pBBTT->u32PageClock;
+            pBBTT->iCurPage = iPage;
+            bbttPageHit(pBBTT, iPage);
+            pBBTT->u32FilePos = u32Offset + iLen;
+            return &pBBTT->pFileBuf[iPage * pBBTT->iFileBufSize + (u32Offset - pPage->u32Start)];
+        }
+    }
+    return NULL;
+} /* bbttPeekRecord() */
+
+//
+// Return a pointer to iLen bytes of the font starting at u32Offset; where
+// bbttPeekRecord can't point at them, they're read into pTemp (zero filled
+// past the end of the font). Leaves the read position after the record
+//
+const uint8_t *bbttGetRecord(BBTT *pBBTT, uint32_t u32Offset, int iLen, uint8_t *pTemp)
+{
+    const uint8_t *p = bbttPeekRecord(pBBTT, u32Offset, iLen);
+
+    if (p) {
+        return p;
+    }
+    memset(pTemp, 0, iLen);
+    bbttSeek(pBBTT, u32Offset);
+    bbttRead(pBBTT, pTemp, iLen);
+    return pTemp;
+} /* bbttGetRecord() */
 
-    length = (length + 3) / 4;
-    bbttSeek(pBBTT, offset);
+//
+// Return p with at least 2 bytes of the span after it (all that's left at its
+// end). A span that isn't in memory and is larger than u8GlyphBuf is read in
+// pieces; the piece starting at p replaces the bytes already decoded
+//
+const uint8_t *bbttSpanNext(BBTT *pBBTT, ttRecordSpan_t *pSpan, const uint8_t *p)
+{
+    uint32_t u32Pos = pSpan->u32Start + (uint32_t)(p - pSpan->pStart);
+    uint32_t u32Left = pSpan->u32End - u32Pos;
 
-    while (length-- > 0) {
-        checksum += bbttGetUInt32t(pBBTT);
+    if (pSpan->pEnd - p >= 2 || (uint32_t)(pSpan->pEnd - p) == u32Left) {
+        return p;
     }
-    return checksum;
-}
+    p = bbttPeekRecord(pBBTT, u32Pos, (int)u32Left);
+    if (p == NULL) {
+        if (u32Left > GLYPH_BUF_SIZE) {
+            u32Left = GLYPH_BUF_SIZE;
+        }
+        p = bbttGetRecord(pBBTT, u32Pos, (int)u32Left, pBBTT->u8GlyphBuf);
+    }
+    pSpan->pStart = p;
+    pSpan->pEnd = p + u32Left;
+    pSpan->u32Start = u32Pos;
+    return p;
+} /* bbttSpanNext() */
+
+//
+// Seek to a record of u32Len bytes. With read-ahead on, a file font record that
+// isn't already buffered is loaded by a single read of exactly its size
+//
+void bbttSeekRecord(BBTT *pBBTT, uint32_t u32Offset, uint32_t u32Len)
+{
+    if (pBBTT->iPrefetchCount && bbttFindPrefetch(pBBTT, u32Offset, u32Len)) {
+        // staged; note how far the reads would have jumped in drawing order
+        if (pBBTT->u32DrawRecordEnd) {
+            pBBTT->u32DrawSeek += (u32Offset > pBBTT->u32DrawRecordEnd) ? u32Offset - pBBTT->u32DrawRecordEnd : pBBTT->u32DrawRecordEnd - u32Offset;
+        }
+        pBBTT->u32DrawRecordEnd = u32Offset + u32Len;
+        pBBTT->u32DrawRecords++;
+        pBBTT->u32FilePos = u32Offset;
+        return;
+    }
+    if (pBBTT->pAsyncData && u32Offset == pBBTT->asyncGlyph.offset && u32Len <= pBBTT->asyncGlyph.length) {
+        pBBTT->u32FilePos = u32Offset; // read by the worker thread
+        return;
+    }
+    bbttSeek(pBBTT, u32Offset);
+    if (!pBBTT->pTTF && pBBTT->bReadAhead && u32Len && u32Len <= (uint32_t)pBBTT->iFileBufSize) {
+        if (bbttFindPage(pBBTT, u32Offset, u32Len) < 0) {
+            pBBTT->iNextReadSize = (int)u32Len; // the next read loads a page with all of it
+        }
+    }
+} /* bbttSeekRecord() */
+
+//
+// Split pBuffer into pages of iPageSize bytes (up to MAX_FILE_PAGES) that
+// cache file font reads, replacing the least recently used page on a miss.
+// Up to iPinned pages of cmap/loca data are kept until the font changes.
+// Read-ahead loads each glyph record in one read
+//
+uint8_t bbttSetPageCache(BBTT *pBBTT, uint8_t *pBuffer, uint32_t u32Size, int iPageSize, int iPinned, uint8_t bReadAhead)
+{
+    if (pBuffer == NULL || iPageSize <= 0 || u32Size < (uint32_t)iPageSize || iPinned < 0) {
+        pBBTT->lastError = BBTT_INVALID_PARAMETER;
+        return 0;
+    }
+    pBBTT->pFileBuf = pBuffer;
+    pBBTT->iFileBufSize = iPageSize;
+    pBBTT->iPageCount = (int)(u32Size / iPageSize);
+    if (pBBTT->iPageCount > MAX_FILE_PAGES) {
+        pBBTT->iPageCount = MAX_FILE_PAGES;
+    }
+    if (iPinned >= pBBTT->iPageCount) { // at least one page must be free to replace
+        iPinned = pBBTT->iPageCount - 1;
+    }
+    pBBTT->iMaxPinned = iPinned;
+    pBBTT->iNextReadSize = 0;
+    pBBTT->bReadAhead = bReadAhead;
+    bbttClearPages(pBBTT);
+    return 1;
+} /* bbttSetPageCache() */
+
+//
+// Use a different read buffer for file fonts (NULL = the internal FILE_BUF_SIZE one)
+// A larger buffer means fewer reads; read-ahead loads each glyph record in one read
+//
+void bbttSetFileBuffer(BBTT *pBBTT, uint8_t *pBuffer, int iSize, uint8_t bReadAhead)
+{
+    if (pBuffer == NULL || iSize <= 0) {
+        pBuffer = pBBTT->u8FileBuf;
+        iSize = FILE_BUF_SIZE;
+    }
+    bbttSetPageCache(pBBTT, pBuffer, (uint32_t)iSize, iSize, 0, bReadAhead);
+} /* bbttSetFileBuffer() */
+
+/* sum u32Len bytes (a multiple of 4) as big endian words */
+uint32_t bbttSumWords(const uint8_t *p, uint32_t u32Len)
+{
+    uint32_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+
+    // independent sums so the loads/adds can overlap (and vectorize)
+    for (; u32Len >= 16; u32Len -= 16, p += 16) {
+        s0 += TT_U32(p);
+        s1 += TT_U32(&p[4]);
+        s2 += TT_U32(&p[8]);
+        s3 += TT_U32(&p[12]);
+    }
+    for (; u32Len; u32Len -= 4, p += 4) {
+        s0 += TT_U32(p);
+    }
+    return s0 + s1 + s2 + s3;
+} /* bbttSumWords() */
+
+//
+// Checksum of u32Len bytes (a multiple of 4) at u32Offset; bytes past the end
+// of the font count as 0. A file font is read in GLYPH_BUF_SIZE pieces
+//
+uint32_t bbttCalculateCheckSum(BBTT *pBBTT, uint32_t u32Offset, uint32_t u32Len)
+{
+    uint32_t u32Sum = 0;
+    uint32_t u32Size = (pBBTT->pTTF) ? pBBTT->u32TTFSize : (uint32_t)pBBTT->ttFile.iSize;
+    uint32_t u32Avail = (u32Offset < u32Size) ? u32Size - u32Offset : 0;
+    uint8_t *pTemp = pBBTT->u8GlyphBuf;
+
+    if (u32Avail > u32Len) {
+        u32Avail = u32Len;
+    }
+    if (pBBTT->pTTF) {
+        u32Sum = bbttSumWords(&pBBTT->pTTF[u32Offset], u32Avail & ~3);
+        if (u32Avail & 3) { // the font ends inside this word
+            memset(pTemp, 0, 4);
+            memcpy(pTemp, &pBBTT->pTTF[u32Offset + (u32Avail & ~3)], u32Avail & 3);
+            u32Sum += TT_U32(pTemp);
+        }
+        return u32Sum;
+    }
+    bbttSeek(pBBTT, u32Offset);
+    while (u32Avail) {
+        uint32_t u32Count = (u32Avail > GLYPH_BUF_SIZE) ? GLYPH_BUF_SIZE : u32Avail;
+        int iRead = bbttRead(pBBTT, pTemp, (int)u32Count);
+        if (iRead < 0) iRead = 0;
+        memset(&pTemp[iRead], 0, ((u32Count + 3) & ~3) - iRead);
+        u32Sum += bbttSumWords(pTemp, (u32Count + 3) & ~3);
+        if ((uint32_t)iRead < u32Count) {
+            break;
+        }
+        u32Avail -= u32Count;
+    }
+    return u32Sum;
+} /* bbttCalculateCheckSum() */
+
+//
+// Check the table checksums, u32MaxBytes at a time (0 = all that's left) so the
+// work can be spread over idle time, e.g. while a lazily opened font isn't
+// drawn yet. Returns TT_CHECK_PENDING until every table has been checked
+//
+int bbttCheckFont(BBTT *pBBTT, uint32_t u32MaxBytes)
+{
+    uint32_t u32Budget = (u32MaxBytes) ? (u32MaxBytes + 3) & ~3 : 0xfffffffc;
+
+    while (pBBTT->iCheckState == TT_CHECK_PENDING && u32Budget) {
+        if (pBBTT->iCheckTable >= pBBTT->numTables) {
+            pBBTT->iCheckState = TT_CHECK_OK;
+            break;
+        }
+        ttTable_t *pTable = &pBBTT->table[pBBTT->iCheckTable];
+        uint32_t u32Len = ((pTable->length + 3) & ~3) - pBBTT->u32CheckPos;
+        if (pTable->tag == TT_TAG('h','e','a','d')) { // its checksum can't be checked this way
+            u32Len = 0;
+        }
+        if (u32Len > u32Budget) {
+            u32Len = u32Budget;
+        }
+        pBBTT->u32CheckSum += bbttCalculateCheckSum(pBBTT, pTable->offset + pBBTT->u32CheckPos, u32Len);
+        pBBTT->u32CheckPos += u32Len;
+        u32Budget -= u32Len;
+        if (pTable->tag == TT_TAG('h','e','a','d') || pBBTT->u32CheckPos == ((pTable->length + 3) & ~3)) {
+            if (pTable->tag != TT_TAG('h','e','a','d') && pBBTT->u32CheckSum != pTable->checkSum) {
+                pBBTT->iCheckState = TT_CHECK_FAILED;
+                pBBTT->lastError = BBTT_INVALID_FILE;
+                break;
+            }
+            pBBTT->iCheckTable++;
+            pBBTT->u32CheckPos = pBBTT->u32CheckSum = 0;
+        }
+    }
+    return pBBTT->iCheckState;
+} /* bbttCheckFont() */
 
 uint32_t bbttPosition(BBTT *pBBTT) {
     if (!pBBTT->pTTF) {
-#ifdef ESP32
-        return pBBTT->file.position() - pBBTT->iBufferedBytes;
-#else
-        return 0;
-#endif
+        return pBBTT->u32FilePos;
     } else {
         return pBBTT->u32TTFOffset;
     }
 } /* ttfPosition() */
 
-/* convert character code to glyph id */
-uint16_t bbttCodeToGlyphId(BBTT *pBBTT, uint16_t _code)
+/* read the format 4 word at u32Offset from the index buffer or the font */
+uint16_t bbttCmap4Word(BBTT *pBBTT, uint32_t u32Offset)
+{
+    uint32_t u32Word = (u32Offset - pBBTT->cmapFormat4.endCodeOffset) / 2;
+    uint8_t ucTemp[2];
+
+    if (u32Word < pBBTT->u32Cmap4Words) {
+        return pBBTT->pCmap4[u32Word];
+    }
+    return TT_U16(bbttGetRecord(pBBTT, u32Offset, 2, ucTemp));
+} /* bbttCmap4Word() */
+
+/* search the format 4 subtable for the glyph id of a BMP character code */
+uint16_t bbttCmap4Lookup(BBTT *pBBTT, uint16_t _code)
 {
     uint16_t start, end, idRangeOffset;
     int16_t idDelta;
     uint8_t found = 0;
     uint16_t offset, glyphId = 0;
+    int segCount = pBBTT->cmapFormat4.segCountX2 / 2;
+    int i = 0, iRange = pBBTT->cmapFormat4.searchRange / 2;
+
+    if (segCount == 0) {
+        return 0;
+    }
+    // Binary search for the first segment with endCode >= _code
+    // searchRange/2 is the largest power of 2 <= segCount; if it ends below
+    // _code then the answer is in the last searchRange/2 segments instead
+    if (bbttCmap4Word(pBBTT, pBBTT->cmapFormat4.endCodeOffset + 2 * (iRange - 1)) < _code) {
+        i = pBBTT->cmapFormat4.rangeShift / 2;
+    }
+    for (int j = 0; j < pBBTT->cmapFormat4.entrySelector; j++) {
+        iRange >>= 1;
+        if (bbttCmap4Word(pBBTT, pBBTT->cmapFormat4.endCodeOffset + 2 * (i + iRange - 1)) < _code) {
+            i += iRange;
+        }
+    }
 
-    for (int i = 0; i < pBBTT->cmapFormat4.segCountX2 / 2; i++) {
-        bbttSeek(pBBTT, pBBTT->cmapFormat4.endCodeOffset + 2 * i);
-        end = bbttGetUInt16t(pBBTT);
+    for (; i < segCount; i++) {
+        end = bbttCmap4Word(pBBTT, pBBTT->cmapFormat4.endCodeOffset + 2 * i);
         if (_code <= end) {
-            bbttSeek(pBBTT, pBBTT->cmapFormat4.startCodeOffset + 2 * i);
-            start = bbttGetUInt16t(pBBTT);
+            start = bbttCmap4Word(pBBTT, pBBTT->cmapFormat4.startCodeOffset + 2 * i);
             if (_code >= start) {
-                bbttSeek(pBBTT, pBBTT->cmapFormat4.idDeltaOffset + 2 * i);
-                idDelta = bbttGetInt16t(pBBTT);
-                bbttSeek(pBBTT, pBBTT->cmapFormat4.idRangeOffsetOffset + 2 * i);
-                idRangeOffset = bbttGetUInt16t(pBBTT);
+                idDelta = (int16_t)bbttCmap4Word(pBBTT, pBBTT->cmapFormat4.idDeltaOffset + 2 * i);
+                idRangeOffset = bbttCmap4Word(pBBTT, pBBTT->cmapFormat4.idRangeOffsetOffset + 2 * i);
                 if (idRangeOffset == 0) {
                     glyphId = (idDelta + _code) % 65536;
                 } else {
                     offset = (idRangeOffset / 2 + i + _code - start - pBBTT->cmapFormat4.segCountX2 / 2) * 2;
-                    bbttSeek(pBBTT, pBBTT->cmapFormat4.glyphIndexArrayOffset + offset);
-                    glyphId = bbttGetUInt16t(pBBTT);
+                    glyphId = bbttCmap4Word(pBBTT, pBBTT->cmapFormat4.glyphIndexArrayOffset + offset);
                 }
 
                 found = 1;
@@ -225,187 +866,515 @@ uint16_t bbttCodeToGlyphId(BBTT *pBBTT, uint16_t _code)
         return 0;
     }
     return glyphId;
-} /* bbttCodeToGlyphId() */
+} /* bbttCmap4Lookup() */
 
-/* get glyph offset */
-uint32_t bbttGetGlyphOffset(BBTT *pBBTT, uint16_t index) {
-    uint32_t offset = 0;
-
-    for (int i = 0; i < pBBTT->numTables; i++) {
-        if (strcmp(pBBTT->table[i].name, "loca") == 0) {
-            if (pBBTT->headTable.indexToLocFormat == 1) {
-                bbttSeek(pBBTT, pBBTT->table[i].offset + index * 4);
-                offset = bbttGetUInt32t(pBBTT);
+/* binary search the format 12 groups (12 bytes each) for the glyph id of a character code */
+uint16_t bbttCmap12Lookup(BBTT *pBBTT, uint32_t _code)
+{
+    uint32_t lo = 0, hi = pBBTT->cmapFormat12.numGroups, mid;
+    uint32_t start, end;
+    uint8_t ucTemp[12];
+    const uint8_t *p;
+
+    if (pBBTT->pCmap12) { // preloaded
+        const uint32_t *pGroups = pBBTT->pCmap12;
+        while (lo < hi) {
+            mid = (lo + hi) / 2;
+            if (_code < pGroups[mid * 3]) {
+                hi = mid;
+            } else if (_code > pGroups[mid * 3 + 1]) {
+                lo = mid + 1;
             } else {
-                bbttSeek(pBBTT, pBBTT->table[i].offset + index * 2);
-                offset = bbttGetUInt16t(pBBTT) * 2;
+                return (uint16_t)(pGroups[mid * 3 + 2] + (_code - pGroups[mid * 3]));
             }
-            break;
         }
+        return 0;
     }
-
-    for (int i = 0; i < pBBTT->numTables; i++) {
-        if (strcmp(pBBTT->table[i].name, "glyf") == 0) {
-            return (offset + pBBTT->table[i].offset);
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        p = bbttGetRecord(pBBTT, pBBTT->cmapFormat12.groupsOffset + mid * 12, 12, ucTemp);
+        start = TT_U32(p);
+        end = TT_U32(&p[4]);
+        if (_code < start) {
+            hi = mid;
+        } else if (_code > end) {
+            lo = mid + 1;
+        } else {
+            return (uint16_t)(TT_U32(&p[8]) + (_code - start));
         }
     }
-
     return 0;
-}
+} /* bbttCmap12Lookup() */
 
-/* read coords */
-void bbttReadCoords(BBTT *pBBTT, char _xy, uint16_t _startPoint) {
-    int16_t value = 0;
-    uint8_t shortFlag, sameFlag;
-
-    if (_xy == 'x') {
-        shortFlag = FLAG_XSHORT;
-        sameFlag = FLAG_XSAME;
-    } else {
-        shortFlag = FLAG_YSHORT;
-        sameFlag = FLAG_YSAME;
+//
+// search the cmap for the glyph id of a character code
+// format 12 covers the full repertoire and needs fewer reads per probe, so it's
+// used whenever the font has it; format 4 only maps the BMP
+//
+uint16_t bbttCmapLookup(BBTT *pBBTT, uint32_t _code)
+{
+    if (pBBTT->cmapFormat12.numGroups) {
+        return bbttCmap12Lookup(pBBTT, _code);
     }
+    if (_code <= 0xffff && pBBTT->cmapFormat4.segCountX2) {
+        return bbttCmap4Lookup(pBBTT, (uint16_t)_code);
+    }
+    return 0;
+} /* bbttCmapLookup() */
 
-    for (uint16_t i = _startPoint; i < pBBTT->glyph.numberOfPoints; i++) {
-        if (pBBTT->glyph.points[i].flag & shortFlag) {
-            if (pBBTT->glyph.points[i].flag & sameFlag) {
-                value += bbttGetUInt8t(pBBTT);
-            } else {
-                value -= bbttGetUInt8t(pBBTT);
-            }
-        } else if (~pBBTT->glyph.points[i].flag & sameFlag) {
-            value += bbttGetUInt16t(pBBTT);
-        }
-
-        if (_xy == 'x') {
-            if (pBBTT->glyphTransformation.enableScale) {
-                pBBTT->glyph.points[i].x = value + pBBTT->glyphTransformation.dx;
-            } else {
-                pBBTT->glyph.points[i].x = value + pBBTT->glyphTransformation.dx;
-            }
-        } else {
-            if (pBBTT->glyphTransformation.enableScale) {
-                pBBTT->glyph.points[i].y = value + pBBTT->glyphTransformation.dy;
-            } else {
-                pBBTT->glyph.points[i].y = value + pBBTT->glyphTransformation.dy;
-            }
+/* convert character code to glyph id */
+uint16_t bbttCodeToGlyphId(BBTT *pBBTT, uint32_t _code)
+{
+    if (pBBTT->pGlyphTable && _code >= pBBTT->u16TableFirst && _code <= pBBTT->u16TableLast) {
+        return pBBTT->pGlyphTable[_code - pBBTT->u16TableFirst];
+    }
+    if (pBBTT->asyncGlyph.code == _code) { // queued for the background prefetch
+        return pBBTT->asyncGlyph.glyphId;
+    }
+    for (int i = 0; i < pBBTT->iPrefetchGlyphs; i++) { // already looked up for this string
+        if (pBBTT->prefetchGlyphs[i].code == _code) {
+            return pBBTT->prefetchGlyphs[i].glyphId;
         }
     }
-}
-
-/* read simple glyph */
-uint8_t bbttReadSimpleGlyph(BBTT *pBBTT, uint8_t _addGlyph) {
-    uint8_t repeatCount;
-    uint8_t flag;
-    static uint16_t counterContours;
-    static uint16_t counterPoints;
+    return bbttCmapLookup(pBBTT, _code);
+} /* bbttCodeToGlyphId() */
 
-    if (pBBTT->glyph.numberOfContours <= 0) {
-        return 0;
+//
+// Map every code of the table's range once so that lookups in the
+// range become a single array access. Called when the font is set.
+//
+void bbttFillGlyphTable(BBTT *pBBTT)
+{
+    if (pBBTT->pGlyphTable == NULL) return;
+    for (uint32_t u32 = pBBTT->u16TableFirst; u32 <= pBBTT->u16TableLast; u32++) {
+        pBBTT->pGlyphTable[u32 - pBBTT->u16TableFirst] = bbttCmapLookup(pBBTT, u32);
     }
+} /* bbttFillGlyphTable() */
 
-    if (!_addGlyph) {
-        counterContours = 0;
-        counterPoints = 0;
+//
+// pTable must hold (u16Last - u16First + 1) entries. Set it before the font
+// (or it's filled right away if a font is already loaded); NULL turns it off
+//
+void bbttSetGlyphTable(BBTT *pBBTT, uint16_t *pTable, uint16_t u16First, uint16_t u16Last)
+{
+    if (u16Last < u16First) {
+        pTable = NULL;
     }
-
-    for (uint16_t i = counterContours; i < pBBTT->glyph.numberOfContours; i++) {
-        pBBTT->glyph.endPtsOfContours[i] = counterPoints + bbttGetUInt16t(pBBTT);
+    pBBTT->pGlyphTable = pTable;
+    pBBTT->u16TableFirst = u16First;
+    pBBTT->u16TableLast = u16Last;
+    if (pBBTT->cmapFormat4.segCountX2 || pBBTT->cmapFormat12.numGroups) { // a font is already loaded
+        bbttFillGlyphTable(pBBTT);
     }
+} /* bbttSetGlyphTable() */
 
-    bbttSeek(pBBTT, bbttGetUInt16t(pBBTT) + bbttPosition(pBBTT));
+/* get glyph offset and (optionally) the length of its record */
+uint32_t bbttGetGlyphOffset(BBTT *pBBTT, uint16_t index, uint32_t *pLength) {
+    uint32_t offset = 0, next = 0;
 
-    for (uint16_t i = counterContours; i < pBBTT->glyph.numberOfContours; i++) {
-        if (pBBTT->glyph.endPtsOfContours[i] > pBBTT->glyph.numberOfPoints) {
-            pBBTT->glyph.numberOfPoints = pBBTT->glyph.endPtsOfContours[i];
+    if (pLength) {
+        *pLength = 0;
+    }
+    if (pBBTT->glyfTablePos == 0) {
+        return 0;
+    }
+    if (pBBTT->asyncGlyph.code != 0xffffffff && pBBTT->asyncGlyph.glyphId == index && pBBTT->asyncGlyph.offset) {
+        if (pLength) {
+            *pLength = pBBTT->asyncGlyph.length;
         }
+        return pBBTT->asyncGlyph.offset;
     }
-    pBBTT->glyph.numberOfPoints++;
-
-    for (uint16_t i = counterPoints; i < pBBTT->glyph.numberOfPoints; i++) {
-        flag = bbttGetUInt8t(pBBTT);
-        pBBTT->glyph.points[i].flag = flag;
-        if (flag & FLAG_REPEAT) {
-            repeatCount = bbttGetUInt8t(pBBTT);
-            while (repeatCount--) {
-                pBBTT->glyph.points[++i].flag = flag;
+    for (int i = 0; i < pBBTT->iPrefetchGlyphs; i++) { // already looked up for this string
+        if (pBBTT->prefetchGlyphs[i].glyphId == index && pBBTT->prefetchGlyphs[i].offset) {
+            if (pLength) {
+                *pLength = pBBTT->prefetchGlyphs[i].length;
             }
+            return pBBTT->prefetchGlyphs[i].offset;
         }
     }
-
-    bbttReadCoords(pBBTT, 'x', counterPoints);
-    bbttReadCoords(pBBTT, 'y', counterPoints);
-
-    counterContours = pBBTT->glyph.numberOfContours;
-    counterPoints = pBBTT->glyph.numberOfPoints;
-
-    return 1;
+    if ((uint32_t)index + 1 < pBBTT->u32LocaCount) { // preloaded
+        if (pBBTT->pLocaLong) {
+            offset = pBBTT->pLocaLong[index];
+            next = pBBTT->pLocaLong[index + 1];
+        } else {
+            offset = pBBTT->pLocaShort[index] * 2;
+            next = pBBTT->pLocaShort[index + 1] * 2;
+        }
+        if (pLength && next > offset) {
+            *pLength = next - offset;
+        }
+    } else if (pBBTT->locaTablePos) {
+        uint8_t ucTemp[8];
+        const uint8_t *p;
+        if (pBBTT->headTable.indexToLocFormat == 1) {
+            p = bbttGetRecord(pBBTT, pBBTT->locaTablePos + index * 4, 8, ucTemp);
+            offset = TT_U32(p);
+            next = TT_U32(&p[4]);
+        } else {
+            p = bbttGetRecord(pBBTT, pBBTT->locaTablePos + index * 2, 4, ucTemp);
+            offset = TT_U16(p) * 2;
+            next = TT_U16(&p[2]) * 2;
+        }
+        if (pLength && next > offset) {
+            *pLength = next - offset;
+        }
+    }
+    return (offset + pBBTT->glyfTablePos);
 }
 
-/* read Compound glyph */
-uint8_t bbttReadCompoundGlyph(BBTT *pBBTT) {
-    uint16_t glyphIndex;
-    uint16_t flags;
-    uint8_t numberOfGlyphs = 0;
-    uint32_t offset;
-    int32_t arg1, arg2;
+//
+// Decode the simple glyph record at u32Offset (u32Length bytes) and append its
+// contours to pBBTT->glyph, offset by dx,dy. The flags and coordinates are
+// fetched as one span (in GLYPH_BUF_SIZE pieces if it has to be read and is
+// bigger) and decoded with pointer arithmetic; the span is bounds checked once
+// for the flags and once for all of the coordinates
+//
+uint8_t bbttReadSimpleGlyph(BBTT *pBBTT, uint32_t u32Offset, uint32_t u32Length, int16_t dx, int16_t dy) {
+    uint8_t ucTemp[2 * MAX_CONTOURS + 2];
+    const uint8_t *p;
+    ttRecordSpan_t span;
+    ttGlyph_t *pGlyph = &pBBTT->glyph;
+    int iContours, iFirstContour = pGlyph->numberOfContours;
+    int iFirstPoint = pGlyph->numberOfPoints, iPoints = iFirstPoint;
+    int i, iSize, iCoordSize;
+    uint32_t u32Data, u32End = u32Offset + u32Length;
+    uint8_t flag;
+    int16_t value;
 
-    pBBTT->glyph.numberOfContours = 0;
+    if (u32Length < 10) {
+        return 0;
+    }
+    p = bbttGetRecord(pBBTT, u32Offset, 2, ucTemp);
+    iContours = TT_S16(p);
+    if (iContours <= 0 || iFirstContour + iContours > MAX_CONTOURS) {
+        return 0;
+    }
+    u32Data = u32Offset + 10;
+    p = bbttGetRecord(pBBTT, u32Data, 2 * iContours + 2, ucTemp);
+    for (i = 0; i < iContours; i++) {
+        uint16_t u16End = iFirstPoint + TT_U16(&p[i * 2]);
+        pGlyph->endPtsOfContours[iFirstContour + i] = u16End;
+        if (u16End > iPoints) {
+            iPoints = u16End;
+        }
+    }
+    iPoints++;
+    if (iPoints > MAX_GLYPH_POINTS) {
+        return 0;
+    }
+    u32Data += 2 * iContours + 2 + TT_U16(&p[2 * iContours]); // skip the instructions
+    if (u32Data >= u32End) {
+        return 0;
+    }
+    // flags + coordinates take at most 5 bytes per point
+    iSize = (iPoints - iFirstPoint) * 5;
+    if (u32End - u32Data < (uint32_t)iSize) {
+        iSize = (int)(u32End - u32Data);
+    }
+    span.pStart = span.pEnd = p = NULL; // fetched by the first bbttSpanNext
+    span.u32Start = u32Data;
+    span.u32End = u32Data + iSize;
+
+    iCoordSize = 0;
+    for (i = iFirstPoint; i < iPoints;) {
+        int iRepeat = 1;
+        if (span.pEnd - p < 2) {
+            p = bbttSpanNext(pBBTT, &span, p);
+        }
+        if (p >= span.pEnd) {
+            return 0;
+        }
+        flag = *p++;
+        if (flag & FLAG_REPEAT) {
+            if (p >= span.pEnd) {
+                return 0;
+            }
+            iRepeat += *p++;
+        }
+        // x and y are each 1 byte if short, 0 if repeated, otherwise 2
+        int iBytes = ((flag & FLAG_XSHORT) ? 1 : (flag & FLAG_XSAME) ? 0 : 2) + ((flag & FLAG_YSHORT) ? 1 : (flag & FLAG_YSAME) ? 0 : 2);
+        while (iRepeat-- && i < iPoints) {
+            pGlyph->points[i++].flag = flag;
+            iCoordSize += iBytes;
+        }
+    }
+    if ((uint32_t)iCoordSize > span.u32End - span.u32Start - (uint32_t)(p - span.pStart)) {
+        return 0;
+    }
 
-    do {
-        flags = bbttGetUInt16t(pBBTT);
-        glyphIndex = bbttGetUInt16t(pBBTT);
+    value = 0;
+    for (i = iFirstPoint; i < iPoints; i++) {
+        if (span.pEnd - p < 2) {
+            p = bbttSpanNext(pBBTT, &span, p);
+        }
+        flag = pGlyph->points[i].flag;
+        if (flag & FLAG_XSHORT) {
+            value += (flag & FLAG_XSAME) ? *p : -*p;
+            p++;
+        } else if (~flag & FLAG_XSAME) {
+            value += TT_S16(p);
+            p += 2;
+        }
+        pGlyph->points[i].x = value + dx;
+    }
+    value = 0;
+    for (i = iFirstPoint; i < iPoints; i++) {
+        if (span.pEnd - p < 2) {
+            p = bbttSpanNext(pBBTT, &span, p);
+        }
+        flag = pGlyph->points[i].flag;
+        if (flag & FLAG_YSHORT) {
+            value += (flag & FLAG_YSAME) ? *p : -*p;
+            p++;
+        } else if (~flag & FLAG_YSAME) {
+            value += TT_S16(p);
+            p += 2;
+        }
+        pGlyph->points[i].y = value + dy;
+    }
+
+    pGlyph->numberOfContours = iFirstContour + iContours;
+    pGlyph->numberOfPoints = iPoints;
+    return 1;
+} /* bbttReadSimpleGlyph() */
 
-        pBBTT->glyphTransformation.enableScale = (flags & 0b00000001000) ? (1) : (0);
+//
+// read Compound glyph; each component is a simple glyph (or another compound
+// glyph, up to MAX_COMPOUND_DEPTH deep) at an x/y offset
+//
+uint8_t bbttReadCompoundGlyph(BBTT *pBBTT, uint32_t u32Offset, uint32_t u32Length, int16_t _dx, int16_t _dy, int iDepth) {
+    uint8_t ucTemp[16];
+    const uint8_t *p;
+    uint16_t glyphIndex;
+    uint16_t flags;
+    int16_t dx, dy;
+    int iLen;
+    uint32_t u32Pos = u32Offset + 10;
 
+    do {
+        if (u32Pos + 6 > u32Offset + u32Length) {
+            break;
+        }
+        iLen = (int)(u32Offset + u32Length - u32Pos);
+        if (iLen > 16) { // longest component header
+            iLen = 16;
+        }
+        p = bbttGetRecord(pBBTT, u32Pos, iLen, ucTemp);
+        flags = TT_U16(p);
+        glyphIndex = TT_U16(&p[2]);
+
+        iLen = (flags & 0b00000000001) ? 8 : 6; // 16 or 8-bit arguments
+        if (flags & 0b00000001000) { // scale (not applied)
+            iLen += 2;
+        } else if (flags & 0b00001000000) { // x and y scale
+            iLen += 4;
+        } else if (flags & 0b00010000000) { // 2x2 transform
+            iLen += 8;
+        }
+        if (u32Pos + iLen > u32Offset + u32Length) {
+            break;
+        }
         if (flags & 0b00000000001) {
-            arg1 = bbttGetInt16t(pBBTT);
-            arg2 = bbttGetInt16t(pBBTT);
+            dx = TT_S16(&p[4]);
+            dy = TT_S16(&p[6]);
         } else {
-            arg1 = bbttGetUInt8t(pBBTT);
-            arg2 = bbttGetUInt8t(pBBTT);
+            dx = (int8_t)p[4];
+            dy = (int8_t)p[5];
         }
+        u32Pos += iLen;
 
-        if (flags & 0b00000000010) {
-            pBBTT->glyphTransformation.dx = arg1;
-            pBBTT->glyphTransformation.dy = arg2;
+        if (!(flags & 0b00000000010)) { // arguments are point numbers; not supported
+            dx = dy = 0;
         }
+        dx += _dx;
+        dy += _dy;
 
-        if (flags & 0b01000000000) {
+        if ((flags & 0b01000000000) && iDepth == 0) {
             pBBTT->charCode = glyphIndex;
         }
 
-        offset = bbttPosition(pBBTT);
+        uint32_t glyphLength;
+        uint32_t glyphOffset = bbttGetGlyphOffset(pBBTT, glyphIndex, &glyphLength);
+        if (glyphLength < 10) {
+            continue; // empty component
+        }
+        bbttSeekRecord(pBBTT, glyphOffset, glyphLength);
+        p = bbttGetRecord(pBBTT, glyphOffset, 2, ucTemp);
+        if (TT_S16(p) >= 0) {
+            bbttReadSimpleGlyph(pBBTT, glyphOffset, glyphLength, dx, dy);
+        } else if (iDepth < MAX_COMPOUND_DEPTH) {
+            bbttReadCompoundGlyph(pBBTT, glyphOffset, glyphLength, dx, dy, iDepth + 1);
+        }
+    } while (flags & 0b00000100000);
+
+    return 1;
+} /* bbttReadCompoundGlyph() */
 
-        uint32_t glyphOffset = bbttGetGlyphOffset(pBBTT, glyphIndex);
-        bbttSeek(pBBTT, glyphOffset);
-        pBBTT->glyph.numberOfContours += bbttGetInt16t(pBBTT);
-        bbttSeek(pBBTT, glyphOffset + 10);
+//
+// LRU cache arena
+// Entries are packed back to back in the caller's buffer; when there's no room
+// the least recently used entry is removed and the ones after it slide down.
+//
+void bbttCacheInit(ttCache_t *pCache, uint8_t *pBuffer, uint32_t u32Size)
+{
+    // keep the entry headers 32-bit aligned
+    uint32_t u32Skip = (4 - ((uintptr_t)pBuffer & 3)) & 3;
+    if (pBuffer == NULL || u32Size <= u32Skip + sizeof(ttCacheEntry_t)) {
+        pCache->pBuffer = NULL;
+        pCache->u32Size = 0;
+    } else {
+        pCache->pBuffer = pBuffer + u32Skip;
+        pCache->u32Size = (u32Size - u32Skip) & ~3;
+    }
+    pCache->u32Used = 0;
+    pCache->u32Clock = 0;
+    memset(&pCache->stats, 0, sizeof(ttCacheStats_t));
+} /* bbttCacheInit() */
 
-        if (numberOfGlyphs == 0) {
-            bbttReadSimpleGlyph(pBBTT, 0);
-        } else {
-            bbttReadSimpleGlyph(pBBTT, 1);
+void bbttCacheEvict(ttCache_t *pCache)
+{
+    uint32_t u32Off = 0, u32Age, u32Oldest = 0, u32OldestOff = 0;
+    ttCacheEntry_t *pOldest = NULL;
+
+    while (u32Off < pCache->u32Used) {
+        ttCacheEntry_t *pEntry = (ttCacheEntry_t *)&pCache->pBuffer[u32Off];
+        u32Age = pCache->u32Clock - pEntry->lastUsed;
+        if (pOldest == NULL || u32Age > u32Oldest) {
+            pOldest = pEntry;
+            u32Oldest = u32Age;
+            u32OldestOff = u32Off;
         }
-        bbttSeek(pBBTT, offset);
+        u32Off += pEntry->size;
+    }
+    if (pOldest) {
+        uint32_t u32Size = pOldest->size;
+        memmove(pOldest, (uint8_t *)pOldest + u32Size, pCache->u32Used - u32OldestOff - u32Size);
+        pCache->u32Used -= u32Size;
+        pCache->stats.evictions++;
+    }
+} /* bbttCacheEvict() */
 
-        numberOfGlyphs++;
-        pBBTT->glyphTransformation = {0, 0, 0, 1, 1};  // init
-    } while (flags & 0b00000100000);
+// returns NULL if the entry can never fit
+ttCacheEntry_t *bbttCacheAlloc(ttCache_t *pCache, uint32_t u32Size)
+{
+    ttCacheEntry_t *pEntry;
 
-    return 1;
-}
+    u32Size = (u32Size + 3) & ~3;
+    if (u32Size > pCache->u32Size) {
+        return NULL;
+    }
+    while (pCache->u32Used + u32Size > pCache->u32Size) {
+        bbttCacheEvict(pCache);
+    }
+    pEntry = (ttCacheEntry_t *)&pCache->pBuffer[pCache->u32Used];
+    pCache->u32Used += u32Size;
+    pEntry->size = u32Size;
+    pEntry->lastUsed = pCache->u32Clock++;
+    return pEntry;
+} /* bbttCacheAlloc() */
+
+//
+// Decoded outline cache
+// Glyphs are kept in font units so that one entry serves every character size.
+//
+void bbttSetGlyphCache(BBTT *pBBTT, uint8_t *pBuffer, uint32_t u32Size)
+{
+    bbttCacheInit(&pBBTT->glyphCache, pBuffer, u32Size);
+} /* bbttSetGlyphCache() */
+
+ttGlyphCacheEntry_t *bbttFindCachedGlyph(BBTT *pBBTT, uint16_t _code)
+{
+    ttCache_t *pCache = &pBBTT->glyphCache;
+    uint32_t u32Off = 0;
+    while (u32Off < pCache->u32Used) {
+        ttGlyphCacheEntry_t *pEntry = (ttGlyphCacheEntry_t *)&pCache->pBuffer[u32Off];
+        if (pEntry->glyphId == _code) {
+            pEntry->hdr.lastUsed = pCache->u32Clock++;
+            return pEntry;
+        }
+        u32Off += pEntry->hdr.size;
+    }
+    return NULL;
+} /* bbttFindCachedGlyph() */
+
+void bbttCacheGlyph(BBTT *pBBTT, uint16_t _code, uint16_t _metricsId)
+{
+    ttGlyph_t *pGlyph = &pBBTT->glyph;
+    ttGlyphCacheEntry_t *pEntry;
+
+    if (pGlyph->numberOfContours < 0 || pGlyph->numberOfContours > MAX_CONTOURS || pGlyph->numberOfPoints > MAX_GLYPH_POINTS) {
+        return; // outside of our limits; don't keep a partial copy
+    }
+    pEntry = (ttGlyphCacheEntry_t *)bbttCacheAlloc(&pBBTT->glyphCache, sizeof(ttGlyphCacheEntry_t) + pGlyph->numberOfContours * sizeof(uint16_t) + pGlyph->numberOfPoints * sizeof(ttPoint_t));
+    if (pEntry == NULL) {
+        return;
+    }
+    pEntry->glyphId = _code;
+    pEntry->metricsId = _metricsId;
+    pEntry->numberOfPoints = pGlyph->numberOfPoints;
+    pEntry->numberOfContours = pGlyph->numberOfContours;
+    pEntry->xMin = pGlyph->xMin;
+    pEntry->yMin = pGlyph->yMin;
+    pEntry->xMax = pGlyph->xMax;
+    pEntry->yMax = pGlyph->yMax;
+    uint8_t *d = (uint8_t *)&pEntry[1];
+    memcpy(d, pGlyph->endPtsOfContours, pGlyph->numberOfContours * sizeof(uint16_t));
+    d += pGlyph->numberOfContours * sizeof(uint16_t);
+    memcpy(d, pGlyph->points, pGlyph->numberOfPoints * sizeof(ttPoint_t));
+} /* bbttCacheGlyph() */
+
+void bbttLoadCachedGlyph(BBTT *pBBTT, ttGlyphCacheEntry_t *pEntry, uint8_t _justSize)
+{
+    ttGlyph_t *pGlyph = &pBBTT->glyph;
+
+    pGlyph->numberOfContours = pEntry->numberOfContours;
+    pGlyph->xMin = pEntry->xMin;
+    pGlyph->yMin = pEntry->yMin;
+    pGlyph->xMax = pEntry->xMax;
+    pGlyph->yMax = pEntry->yMax;
+    pBBTT->glyphTransformation = {0, 0, 0, 1, 1};  // init
+    if (_justSize) {
+        pGlyph->numberOfPoints = 0;
+        return;
+    }
+    pGlyph->numberOfPoints = pEntry->numberOfPoints;
+    uint8_t *s = (uint8_t *)&pEntry[1];
+    memcpy(pGlyph->endPtsOfContours, s, pEntry->numberOfContours * sizeof(uint16_t));
+    s += pEntry->numberOfContours * sizeof(uint16_t);
+    memcpy(pGlyph->points, s, pEntry->numberOfPoints * sizeof(ttPoint_t));
+    if (pEntry->metricsId != pEntry->glyphId) {
+        pBBTT->charCode = pEntry->metricsId;
+    }
+} /* bbttLoadCachedGlyph() */
 
 /* read glyph */
 uint8_t bbttReadGlyph(BBTT *pBBTT, uint16_t _code, uint8_t _justSize) {
-    uint32_t offset = bbttGetGlyphOffset(pBBTT, _code);
-    bbttSeek(pBBTT, offset);
-    pBBTT->glyph.numberOfContours = bbttGetInt16t(pBBTT);
+    uint8_t rc;
+
+    if (pBBTT->glyphCache.pBuffer) {
+        ttGlyphCacheEntry_t *pEntry = bbttFindCachedGlyph(pBBTT, _code);
+        if (pEntry) {
+            pBBTT->glyphCache.stats.hits++;
+            bbttLoadCachedGlyph(pBBTT, pEntry, _justSize);
+            return (_justSize) ? 0 : 1;
+        }
+        pBBTT->glyphCache.stats.misses++;
+    }
+    uint32_t length;
+    uint32_t offset = bbttGetGlyphOffset(pBBTT, _code, &length);
+    pBBTT->glyph.numberOfContours = 0;
     pBBTT->glyph.numberOfPoints = 0;
-    pBBTT->glyph.xMin = bbttGetInt16t(pBBTT);
-    pBBTT->glyph.yMin = bbttGetInt16t(pBBTT);
-    pBBTT->glyph.xMax = bbttGetInt16t(pBBTT);
-    pBBTT->glyph.yMax = bbttGetInt16t(pBBTT);
+    pBBTT->glyph.xMin = pBBTT->glyph.yMin = pBBTT->glyph.xMax = pBBTT->glyph.yMax = 0;
+    if (length >= 10) { // an empty record (e.g. space) has no header
+        uint8_t ucTemp[10];
+        bbttSeekRecord(pBBTT, offset, length);
+        const uint8_t *p = bbttGetRecord(pBBTT, offset, 10, ucTemp);
+        pBBTT->glyph.numberOfContours = TT_S16(p);
+        pBBTT->glyph.xMin = TT_S16(&p[2]);
+        pBBTT->glyph.yMin = TT_S16(&p[4]);
+        pBBTT->glyph.xMax = TT_S16(&p[6]);
+        pBBTT->glyph.yMax = TT_S16(&p[8]);
+    }
 
     pBBTT->glyphTransformation = {0, 0, 0, 1, 1};  // init
 
@@ -413,23 +1382,39 @@ uint8_t bbttReadGlyph(BBTT *pBBTT, uint16_t _code, uint8_t _justSize) {
         return 0;
     }
 
+    uint16_t u16MetricsId = pBBTT->charCode = _code;
     if (pBBTT->glyph.numberOfContours >= 0) {
-        return bbttReadSimpleGlyph(pBBTT, 0);
+        pBBTT->glyph.numberOfContours = 0; // the decoder appends contours
+        rc = bbttReadSimpleGlyph(pBBTT, offset, length, 0, 0);
     } else {
-        return bbttReadCompoundGlyph(pBBTT);
+        pBBTT->glyph.numberOfContours = 0;
+        rc = bbttReadCompoundGlyph(pBBTT, offset, length, 0, 0, 0);
+        u16MetricsId = pBBTT->charCode; // USE_MY_METRICS can change it
     }
-    return 0;
+    if (pBBTT->glyphCache.pBuffer) {
+        bbttCacheGlyph(pBBTT, _code, u16MetricsId);
+    }
+    return rc;
+}
+
+/* return the index of the table with the given tag or -1 */
+int bbttFindTable(BBTT *pBBTT, uint32_t tag) {
+    for (int i = 0; i < pBBTT->numTables; i++) {
+        if (pBBTT->table[i].tag == tag) {
+            return i;
+        }
+    }
+    return -1;
 }
 
 /* seek to the first position of the specified table name */
 uint32_t bbttSeekToTable(BBTT *pBBTT, const char *name) {
-    for (uint32_t i = 0; i < pBBTT->numTables; i++) {
-        if (strcmp(pBBTT->table[i].name, name) == 0) {
-            bbttSeek(pBBTT, pBBTT->table[i].offset);
-            return pBBTT->table[i].offset;
-        }
+    int i = bbttFindTable(pBBTT, TT_TAG(name[0], name[1], name[2], name[3]));
+    if (i < 0) {
+        return 0;
     }
-    return 0;
+    bbttSeek(pBBTT, pBBTT->table[i].offset);
+    return pBBTT->table[i].offset;
 }
 
 uint8_t bbttReadHhea(BBTT *pBBTT) {
@@ -473,9 +1458,14 @@ ttHMetric_t bbttGetHMetric(BBTT *pBBTT, uint16_t _code) {
     if (_code >= pBBTT->numOfLongHorMetrics) { // must be monospaced font, use 0
         _code = 0;
     }
-    bbttSeek(pBBTT, pBBTT->hmtxTablePos + (_code * 4));
-    result.advanceWidth = bbttGetUInt16t(pBBTT);
-    result.leftSideBearing = bbttGetInt16t(pBBTT);
+    if (pBBTT->pHMetrics) {
+        result = pBBTT->pHMetrics[_code];
+    } else {
+        uint8_t ucTemp[4];
+        const uint8_t *p = bbttGetRecord(pBBTT, pBBTT->hmtxTablePos + (_code * 4), 4, ucTemp);
+        result.advanceWidth = TT_U16(p);
+        result.leftSideBearing = TT_S16(&p[2]);
+    }
     if (result.advanceWidth == 0) { // monospaced font
         result.advanceWidth = pBBTT->xMax - pBBTT->xMin;
     }
@@ -485,12 +1475,34 @@ ttHMetric_t bbttGetHMetric(BBTT *pBBTT, uint16_t _code) {
     return result;
 }
 
+//
+// Return the character code at szwString and the number of wchar_t it uses;
+// a UTF-16 surrogate pair (16-bit wchar_t) is combined into one code
+//
+uint32_t bbttGetCode(const wchar_t *szwString, int *pLen)
+{
+    uint32_t u32Hi = (uint32_t)szwString[0];
+
+    *pLen = 1;
+    if (u32Hi >= 0xd800 && u32Hi <= 0xdbff) {
+        uint32_t u32Lo = (uint32_t)szwString[1];
+        if (u32Lo >= 0xdc00 && u32Lo <= 0xdfff) {
+            *pLen = 2;
+            return 0x10000 + ((u32Hi - 0xd800) << 10) + (u32Lo - 0xdc00);
+        }
+    }
+    return u32Hi;
+} /* bbttGetCode() */
+
 uint16_t bbttGetStringWidthW(BBTT *pBBTT, const wchar_t *szwString)
 {
     uint16_t prev_code = 0;
     uint16_t c = 0;
     uint16_t output = 0;
 
+    if (!bbttFontReady(pBBTT)) {
+        return 0;
+    }
     while (szwString[c] != '\0') {
         // space (half-width, full-width)
         if ((szwString[c] == ' ') || (szwString[c] == L'　')) {
@@ -499,7 +1511,8 @@ uint16_t bbttGetStringWidthW(BBTT *pBBTT, const wchar_t *szwString)
             c++;
             continue;
         }
-        uint16_t code = bbttCodeToGlyphId(pBBTT, szwString[c]);
+        int iLen;
+        uint16_t code = bbttCodeToGlyphId(pBBTT, bbttGetCode(&szwString[c], &iLen));
         bbttReadGlyph(pBBTT, code, 1);
 
         output += pBBTT->characterSpace;
@@ -513,7 +1526,7 @@ uint16_t bbttGetStringWidthW(BBTT *pBBTT, const wchar_t *szwString)
 
         ttHMetric_t hMetric = bbttGetHMetric(pBBTT, code);
         output += hMetric.advanceWidth;
-        c++;
+        c += iLen;
     }
 
     return output;
@@ -543,39 +1556,23 @@ void bbttSetTextBoundary(BBTT *pBBTT, uint16_t _start_x, uint16_t _end_x, uint16
     pBBTT->start_x = _start_x;
     pBBTT->end_x = _end_x;
     pBBTT->end_y = _end_y;
+    bbttSetClip(pBBTT);
 }
 
-void bbttDrawPixel(BBTT *pBBTT, uint16_t _x, uint16_t _y, uint16_t _colorCode)
+//
+// Clip a pixel to the text boundary (see bbttSetClip)
+// returns 0 if the pixel is not visible
+//
+int bbttMapPixel(BBTT *pBBTT, int16_t _x, int16_t _y)
 {
-    uint8_t *buf_ptr;
-
-    // limit to boundary co-ordinates the boundary is always in the same orientation as the string not the buffer
-    if ((_x < pBBTT->start_x) || (_x >= pBBTT->end_x) || (_y >= pBBTT->end_y)) {
-        return;
-    }
+    return (_x >= pBBTT->clipX1 && _x < pBBTT->clipX2 && _y >= pBBTT->clipY1 && _y < pBBTT->clipY2);
+} /* bbttMapPixel() */
 
-    // Rotate co-ordinates relative to the buffer
-    uint16_t temp = _x;
-    switch (pBBTT->stringRotation) {
-        case ROTATE_270:
-            _x = _y;
-            _y = pBBTT->displayHeight - 1 - temp;
-            break;
-        case ROTATE_180:
-            _x = pBBTT->displayWidth - 1 - _x;
-            _y = pBBTT->displayHeight - 1 - _y;
-            break;
-        case ROTATE_90:
-            _x = pBBTT->displayWidth - 1 - _y;
-            _y = temp;
-            break;
-        case 0:
-        default:
-            break;
-    }
+void bbttDrawPixel(BBTT *pBBTT, int16_t _x, int16_t _y, uint16_t _colorCode)
+{
+    uint8_t *buf_ptr;
 
-    // out of range
-    if ((_x < 0) || ((uint16_t)_x >= pBBTT->displayWidth) || ((uint16_t)_y >= pBBTT->displayHeight) || (_y < 0)) {
+    if (!bbttMapPixel(pBBTT, _x, _y)) {
         return;
     }
 
@@ -613,14 +1610,163 @@ void bbttDrawPixel(BBTT *pBBTT, uint16_t _x, uint16_t _y, uint16_t _colorCode)
     }
 } /* bbttDrawPixel() */
 
-void bbttDrawLine(BBTT *pBBTT, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint16_t _colorCode)
+//
+// Blend the color into the framebuffer with an 8-bit alpha (0-255)
+// 4 and 8-bit framebuffers are treated as grayscale, 16-bit as RGB565
+// and 1-bit pixels are set when the coverage is at least 50%
+//
+void bbttDrawPixelAlpha(BBTT *pBBTT, int16_t _x, int16_t _y, uint16_t _colorCode, uint8_t _alpha)
+{
+    uint8_t *buf_ptr;
+
+    if (_alpha == 0xff || pBBTT->framebufferBit == 1) {
+        if (_alpha >= 0x80) {
+            bbttDrawPixel(pBBTT, _x, _y, _colorCode);
+        }
+        return;
+    }
+    if (!bbttMapPixel(pBBTT, _x, _y)) {
+        return;
+    }
+    switch (pBBTT->framebufferBit) {
+        case 16:  // 16bit horizontal
+        {
+            uint16_t *p = (uint16_t *)&pBBTT->userFrameBuffer[(uint16_t)_x * 2 + (uint16_t)_y * pBBTT->displayWidthFrame];
+            uint16_t u16Old = *p;
+            if (pBBTT->bBigEndian) {
+                u16Old = (u16Old >> 8) | (u16Old << 8);
+            }
+            // blend the red+blue and the green components in parallel
+            uint32_t u32Old = (u16Old | ((uint32_t)u16Old << 16)) & 0x07e0f81f;
+            uint32_t u32New = (_colorCode | ((uint32_t)_colorCode << 16)) & 0x07e0f81f;
+            uint32_t a = _alpha >> 3; // 5-bit alpha
+            u32Old = ((u32Old * (32 - a) + u32New * a) >> 5) & 0x07e0f81f;
+            _colorCode = (uint16_t)(u32Old | (u32Old >> 16));
+            if (pBBTT->bBigEndian) {
+                _colorCode = (_colorCode >> 8) | (_colorCode << 8);
+            }
+            *p = _colorCode;
+        } break;
+        case 8:  // 8bit Horizontal
+        {
+            buf_ptr = &pBBTT->userFrameBuffer[(uint16_t)_x + (uint16_t)_y * pBBTT->displayWidthFrame];
+            int iOld = *buf_ptr;
+            *buf_ptr = (uint8_t)(iOld + ((((int)(uint8_t)_colorCode - iOld) * _alpha) / 255));
+        } break;
+        case 4:  // 4bit Horizontal
+        {
+            buf_ptr = &pBBTT->userFrameBuffer[((uint16_t)_x / 2) + (uint16_t)_y * pBBTT->displayWidthFrame];
+            int iOld = ((uint16_t)_x & 1) ? (*buf_ptr & 0xf) : (*buf_ptr >> 4);
+            int iNew = iOld + ((((int)(_colorCode & 0xf) - iOld) * _alpha + 127) / 255);
+            if ((uint16_t)_x & 1) {
+                *buf_ptr = (*buf_ptr & 0b11110000) + iNew;
+            } else {
+                *buf_ptr = (*buf_ptr & 0b00001111) + (iNew << 4);
+            }
+        } break;
+    }
+} /* bbttDrawPixelAlpha() */
+
+// set (ucSet = 0xff) or clear (ucSet = 0) bits x1 to x2 of a 1-bit row, MSB first
+void bbttWriteBits(uint8_t *pRow, int16_t x1, int16_t x2, uint8_t ucSet)
+{
+    uint8_t *p = &pRow[x1 / 8];
+    uint8_t ucFirst = 0xff >> (x1 & 7);
+    uint8_t ucLast = 0xff << (7 - (x2 & 7));
+    int iBytes = (x2 / 8) - (x1 / 8);
+
+    if (iBytes == 0) {
+        ucFirst &= ucLast;
+        *p = (*p & ~ucFirst) | (ucSet & ucFirst);
+        return;
+    }
+    *p = (*p & ~ucFirst) | (ucSet & ucFirst);
+    p++;
+    memset(p, ucSet, iBytes - 1);
+    p += iBytes - 1;
+    *p = (*p & ~ucLast) | (ucSet & ucLast);
+} /* bbttWriteBits() */
+
+//
+// Horizontal run writers for each framebuffer format
+// (buffer co-ordinates, already clipped)
+//
+void bbttWriteRow(BBTT *pBBTT, int16_t x1, int16_t x2, int16_t y, uint16_t _colorCode)
+{
+    uint8_t *pRow = &pBBTT->userFrameBuffer[(uint16_t)y * pBBTT->displayWidthFrame];
+    int iCount = x2 - x1 + 1;
+
+    switch (pBBTT->framebufferBit) {
+        case 16:  // 16bit horizontal
+        {
+            uint16_t *p = (uint16_t *)&pRow[x1 * 2];
+            if (pBBTT->bBigEndian) {
+                _colorCode = (_colorCode >> 8) | (_colorCode << 8);
+            }
+            if ((_colorCode >> 8) == (_colorCode & 0xff)) {
+                memset(p, (uint8_t)_colorCode, iCount * 2);
+            } else {
+                while (iCount--) {
+                    *p++ = _colorCode;
+                }
+            }
+        } break;
+        case 8:  // 8bit Horizontal
+            memset(&pRow[x1], (uint8_t)_colorCode, iCount);
+            break;
+        case 4:  // 4bit Horizontal
+        {
+            uint8_t c = _colorCode & 0b00001111;
+            uint8_t *p = &pRow[x1 / 2];
+            if (x1 & 1) { // odd leading pixel
+                *p = (*p & 0b11110000) + c;
+                p++;
+                iCount--;
+            }
+            memset(p, c | (c << 4), iCount / 2);
+            if (iCount & 1) { // even trailing pixel
+                p += iCount / 2;
+                *p = (*p & 0b00001111) + (c << 4);
+            }
+        } break;
+        case 1:  // 1bit Horizontal
+        default:
+            bbttWriteBits(pRow, x1, x2, (_colorCode) ? 0xff : 0x00);
+            break;
+    }
+} /* bbttWriteRow() */
+
+//
+// Draw a horizontal run of pixels (x2 inclusive)
+// Clipping is done once for the whole run
+//
+void bbttDrawSpan(BBTT *pBBTT, int16_t x1, int16_t x2, int16_t y, uint16_t _colorCode)
+{
+    if (y < pBBTT->clipY1 || y >= pBBTT->clipY2) return;
+    if (x1 < pBBTT->clipX1) x1 = pBBTT->clipX1;
+    if (x2 >= pBBTT->clipX2) x2 = pBBTT->clipX2 - 1;
+    if (x1 > x2) return;
+    bbttWriteRow(pBBTT, x1, x2, y, _colorCode);
+} /* bbttDrawSpan() */
+
+void bbttDrawLine(BBTT *pBBTT, int16_t x1, int16_t y1, int16_t x2, int16_t y2, uint16_t _colorCode)
 {
     int temp;
-    int dx = x2 - x1;
-    int dy = y2 - y1;
+    int dx, dy;
     int error;
     int xinc, yinc;
-    
+    int a = 1, b = 0, c = 0, d = 1; // turns a pixel of the line into the framebuffer
+
+    if (pBBTT->transformType == TRANSFORM_QUARTER) {
+        // draw the line as it is unturned (the steps aren't symmetric) and
+        // turn each pixel; a quarter turn's inverse is its transpose
+        a = pBBTT->transform.xx >> 16; b = pBBTT->transform.xy >> 16;
+        c = pBBTT->transform.yx >> 16; d = pBBTT->transform.yy >> 16;
+        temp = a * x1 + c * y1; y1 = b * x1 + d * y1; x1 = temp;
+        temp = a * x2 + c * y2; y2 = b * x2 + d * y2; x2 = temp;
+    }
+    dx = x2 - x1;
+    dy = y2 - y1;
     if(abs(dx) > abs(dy)) {
         // X major case
         if (x2 < x1) {
@@ -639,8 +1785,8 @@ void bbttDrawLine(BBTT *pBBTT, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y
             dy = -dy;
             yinc = -1;
         }
-        for(; x1 <= x2; x1++) {
-            bbttDrawPixel(pBBTT, x1, y1, _colorCode);
+        for (int x = x1; x <= x2; x++) { // (an int16_t counter would wrap at 32767)
+            bbttDrawPixel(pBBTT, a * x + b * y1, c * x + d * y1, _colorCode);
             error -= dy;
             if (error < 0) { // y needs to change, write existing pixels
                 error += dx;
@@ -665,8 +1811,8 @@ void bbttDrawLine(BBTT *pBBTT, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y
             dx = -dx;
             xinc = -1;
         }
-        for(; y1 <= y2; y1++) {
-            bbttDrawPixel(pBBTT, x1, y1, _colorCode);
+        for (int y = y1; y <= y2; y++) {
+            bbttDrawPixel(pBBTT, a * x1 + b * y, c * x1 + d * y, _colorCode);
             error -= dx;
             if (error < 0) { // x needs to change, write any pixels we traversed
                 error += dy;
@@ -697,6 +1843,9 @@ void bbttDrawOutline(BBTT *pBBTT, int16_t _x, int16_t _y, uint16_t characterSize
 } /* drawOutline() */
 
 void bbttAddLine(BBTT *pBBTT, int16_t _x0, int16_t _y0, int16_t _x1, int16_t _y1) {
+    if (pBBTT->numPoints >= MAX_POINTS - 1) { // outline is too complex; drop the rest
+        return;
+    }
     if (pBBTT->numPoints == 0) {
         pBBTT->points[pBBTT->numPoints].x = _x0;
         pBBTT->points[pBBTT->numPoints++].y = _y0;
@@ -706,198 +1855,1575 @@ void bbttAddLine(BBTT *pBBTT, int16_t _x0, int16_t _y0, int16_t _x1, int16_t _y1
     pBBTT->points[pBBTT->numPoints++].y = _y1;
 }
 
+//
+// Number of line segments for the curve from p[0] through control point p[1]
+// to p[2]. Each of n equal steps strays at most |p0 - 2p1 + p2| / 4n^2 from the
+// curve, so take the smallest n that keeps it within the tolerance in output
+// pixels (the anti-aliased outline's sub-pixels don't make it finer)
+//
+int bbttCurveSteps(BBTT *pBBTT, const ttCoordinate_t *p)
+{
+    int32_t dx = p[0].x - 2 * p[1].x + p[2].x;
+    int32_t dy = p[0].y - 2 * p[1].y + p[2].y;
+    uint32_t u32Dist, u32Dev;
+    int n = 1;
+
+    if (dx < 0) dx = -dx;
+    if (dy < 0) dy = -dy;
+    u32Dist = (dx > dy) ? dx + dy / 2 : dy + dx / 2; // ~length without sqrt
+    // deviation of a single step in 1/16 pixels
+    u32Dev = (uint32_t)(((uint64_t)u32Dist * pBBTT->characterSize * 4) / pBBTT->headTable.unitsPerEm);
+    if (pBBTT->transformType != TRANSFORM_NONE) { // which the transform may stretch
+        u32Dev = (uint32_t)(((uint64_t)u32Dev * pBBTT->transformScale) >> 16);
+    }
+    while (n < MAX_CURVE_STEPS && (uint32_t)(n * n) * pBBTT->curveTolerance < u32Dev) {
+        n++;
+    }
+    return n;
+} /* bbttCurveSteps() */
+
+// floor(a / d) for d > 0; *pRem gets the remainder (0 <= rem < d)
+int32_t bbttFloorDiv(int32_t a, int32_t d, int32_t *pRem)
+{
+    int32_t q = a / d, r = a % d;
+
+    if (r < 0) {
+        q--;
+        r += d;
+    }
+    *pRem = r;
+    return q;
+} /* bbttFloorDiv() */
+
+//
+// v * characterSize / unitsPerEm in 16.16 fixed point. The magnitude is
+// rounded up so a point that lands exactly on a pixel edge isn't truncated
+// into the pixel before it
+//
+int32_t bbttScale16(BBTT *pBBTT, const ttScale_t *pScale, int32_t v)
+{
+    int32_t rem;
+    int32_t c = v * pScale->q + bbttFloorDiv(v * pScale->r, pBBTT->headTable.unitsPerEm, &rem);
+
+    if (rem && c >= 0) {
+        c++;
+    }
+    return c;
+} /* bbttScale16() */
+
+// 16.16 to whole pixels, truncated toward 0 like the on-curve points
+int16_t bbttPixel16(int32_t v)
+{
+    return (int16_t)((v >= 0) ? (v >> 16) : -((-v) >> 16));
+} /* bbttPixel16() */
+
+//
+// Add the quadratic curve p[0], p[1], p[2] as n line segments with forward
+// differencing. The control points are scaled to 16.16 pixels once; then each
+// co-ordinate and its first and second differences are kept as a whole part
+// plus a remainder in 1/n^2 units, so the steps are exact and need only adds.
+// Like the on-curve points, they're truncated relative to the glyph origin
+// before _x, _y is added, so a glyph gets the same pixels wherever it's drawn
+// (and in the bitmap cache, which renders at 0, 0)
+//
+void bbttAddCurve(BBTT *pBBTT, const ttCoordinate_t *p, int n, int16_t _x, int16_t _y, uint16_t characterSize, const ttScale_t *pScale)
+{
+    int32_t nn = n * n;
+    int32_t v[2], r[2], d[2], dr[2], dd[2], ddr[2];
+    int16_t x0, y0, x1, y1;
+
+    for (int i = 0; i < 3; i++) {
+        if (abs(p[i].x) > pScale->iMax || abs(pBBTT->ascender - p[i].y) > pScale->iMax) { // too far out for 16.16; use a chord
+            bbttAddLine(pBBTT, p[0].x * characterSize / pBBTT->headTable.unitsPerEm + _x,
+                    (pBBTT->ascender - p[0].y) * characterSize / pBBTT->headTable.unitsPerEm + _y,
+                    p[2].x * characterSize / pBBTT->headTable.unitsPerEm + _x,
+                    (pBBTT->ascender - p[2].y) * characterSize / pBBTT->headTable.unitsPerEm + _y);
+            return;
+        }
+    }
+    if (n == 1) { // flat enough to be a single line
+        bbttAddLine(pBBTT, bbttPixel16(bbttScale16(pBBTT, pScale, p[0].x)) + _x,
+                bbttPixel16(bbttScale16(pBBTT, pScale, pBBTT->ascender - p[0].y)) + _y,
+                bbttPixel16(bbttScale16(pBBTT, pScale, p[2].x)) + _x,
+                bbttPixel16(bbttScale16(pBBTT, pScale, pBBTT->ascender - p[2].y)) + _y);
+        return;
+    }
+    for (int i = 0; i < 2; i++) {
+        int32_t c0, c1, c2, e, a, qe, re, qa, ra;
+        if (i == 0) {
+            c0 = bbttScale16(pBBTT, pScale, p[0].x);
+            c1 = bbttScale16(pBBTT, pScale, p[1].x);
+            c2 = bbttScale16(pBBTT, pScale, p[2].x);
+        } else {
+            c0 = bbttScale16(pBBTT, pScale, pBBTT->ascender - p[0].y);
+            c1 = bbttScale16(pBBTT, pScale, pBBTT->ascender - p[1].y);
+            c2 = bbttScale16(pBBTT, pScale, pBBTT->ascender - p[2].y);
+        }
+        e = c1 - c0;
+        a = (c2 - c1) - e;
+        v[i] = c0;
+        r[i] = 0;
+        // first step (2n * e + a) / n^2, split up so that nothing overflows
+        qe = bbttFloorDiv(2 * e, n, &re);
+        qa = bbttFloorDiv(a, nn, &ra);
+        d[i] = qe + qa;
+        dr[i] = re * n + ra;
+        if (dr[i] >= nn) {
+            dr[i] -= nn;
+            d[i]++;
+        }
+        // then each step grows by 2a / n^2
+        dd[i] = 2 * qa;
+        ddr[i] = 2 * ra;
+        if (ddr[i] >= nn) {
+            ddr[i] -= nn;
+            dd[i]++;
+        }
+    }
+    x0 = bbttPixel16(v[0]) + _x;
+    y0 = bbttPixel16(v[1]) + _y;
+    for (int step = 0; step < n; step++) {
+        for (int i = 0; i < 2; i++) {
+            v[i] += d[i];
+            r[i] += dr[i];
+            if (r[i] >= nn) {
+                r[i] -= nn;
+                v[i]++;
+            }
+            d[i] += dd[i];
+            dr[i] += ddr[i];
+            if (dr[i] >= nn) {
+                dr[i] -= nn;
+                d[i]++;
+            }
+        }
+        x1 = bbttPixel16(v[0]) + _x;
+        y1 = bbttPixel16(v[1]) + _y;
+        bbttAddLine(pBBTT, x0, y0, x1, y1);
+        x0 = x1;
+        y0 = y1;
+    }
+} /* bbttAddCurve() */
+
+// framebuffer position (16.16) of text position _x, _y
+void bbttTransformOrigin(BBTT *pBBTT, int16_t _x, int16_t _y, int32_t *pX, int32_t *pY)
+{
+    const ttTransform_t *t = &pBBTT->transform;
+
+    *pX = (int32_t)((int64_t)t->xx * _x + (int64_t)t->xy * _y + t->tx);
+    *pY = (int32_t)((int64_t)t->yx * _x + (int64_t)t->yy * _y + t->ty);
+} /* bbttTransformOrigin() */
+
+//
+// Transform the outline of the current glyph, generated at the origin with
+// iShift fraction bits (AA_SHIFT or 0), for a glyph origin at framebuffer
+// position _x, _y (16.16). With bSubPixel the points keep their fraction bits
+// and are relative to the whole pixel part of the origin (for bbttFillGlyphAA),
+// otherwise they become framebuffer pixels
+//
+void bbttTransformOutline(BBTT *pBBTT, int32_t _x, int32_t _y, int iShift, uint8_t bSubPixel)
+{
+    const ttTransform_t *t = &pBBTT->transform;
+    int64_t fx = (int64_t)(_x & 0xffff) << iShift, fy = (int64_t)(_y & 0xffff) << iShift;
+    int32_t ox = _x >> 16, oy = _y >> 16;
+
+    for (uint16_t i = 0; i < pBBTT->numPoints; i++) {
+        ttCoordinate_t *p = &pBBTT->points[i];
+        int32_t x = (int32_t)(((int64_t)t->xx * p->x + (int64_t)t->xy * p->y + fx + 0x8000) >> 16);
+        int32_t y = (int32_t)(((int64_t)t->yx * p->x + (int64_t)t->yy * p->y + fy + 0x8000) >> 16);
+        if (!bSubPixel) {
+            x = (x >> iShift) + ox;
+            y = (y >> iShift) + oy;
+        }
+        p->x = (x < INT16_MIN) ? INT16_MIN : (x > INT16_MAX) ? INT16_MAX : x;
+        p->y = (y < INT16_MIN) ? INT16_MIN : (y > INT16_MAX) ? INT16_MAX : y;
+    }
+} /* bbttTransformOutline() */
+
 // generate Bitmap
 void bbttGenerateOutline(BBTT *pBBTT, int16_t _x, int16_t _y, uint16_t characterSize) {
     pBBTT->numPoints = 0;
     pBBTT->numBeginPoints = 0;
     pBBTT->numEndPoints = 0;
 
-    float x0, y0, x1, y1;
-
     uint16_t j = 0;
+    ttScale_t scale;
 
+    scale.q = ((uint32_t)characterSize << 16) / pBBTT->headTable.unitsPerEm;
+    scale.r = ((uint32_t)characterSize << 16) % pBBTT->headTable.unitsPerEm;
+    // keeps points within +/-8191 pixels of the origin (and steps under 2^30)
+    scale.iMax = ((uint32_t)8191 * pBBTT->headTable.unitsPerEm) / characterSize;
     for (uint16_t i = 0; i < pBBTT->glyph.numberOfContours; i++) {
-        uint8_t firstPointOfContour = j;
-        uint8_t lastPointOfContour = pBBTT->glyph.endPtsOfContours[i];
+        uint16_t firstPointOfContour = j;
+        uint16_t lastPointOfContour = pBBTT->glyph.endPtsOfContours[i];
+        const ttPoint_t *pContour = &pBBTT->glyph.points[firstPointOfContour];
 
-        // Rotate to on-curve the first point
-        uint16_t numberOfRotations = 0;
-        while ((firstPointOfContour + numberOfRotations) <= lastPointOfContour) {
-            if (pBBTT->glyph.points[(firstPointOfContour + numberOfRotations)].flag & FLAG_ONCURVE) {
-                break;
-            }
-            numberOfRotations++;
+        if (lastPointOfContour >= pBBTT->glyph.numberOfPoints) {
+            break; // corrupt contour list
         }
-        if ((j + numberOfRotations) <= lastPointOfContour) {
-            for (uint16_t ii = 0; ii < numberOfRotations; ii++) {
-                ttPoint_t tmp = pBBTT->glyph.points[firstPointOfContour];
-                for (uint16_t jj = firstPointOfContour; jj < lastPointOfContour; jj++) {
-                    pBBTT->glyph.points[jj] = pBBTT->glyph.points[jj + 1];
-                }
-                pBBTT->glyph.points[lastPointOfContour] = tmp;
-            }
+        if (lastPointOfContour < firstPointOfContour) {
+            continue; // out of order end point; nothing to draw
+        }
+        uint16_t count = lastPointOfContour - firstPointOfContour + 1;
+
+        // Start from the first on-curve point; the contour is walked from
+        // there with wrapped indices instead of rotating the points in place
+        uint16_t start = 0;
+        while (start < count && !(pContour[start].flag & FLAG_ONCURVE)) {
+            start++;
+        }
+        if (start == count) {
+            start = 0;
         }
 
         ttCoordinate_t pointsOfCurve[6];
-        pointsOfCurve[0].x = pBBTT->glyph.points[j].x;
-        pointsOfCurve[0].y = pBBTT->glyph.points[j].y;
+        pointsOfCurve[0].x = pContour[start].x;
+        pointsOfCurve[0].y = pContour[start].y;
 
-        while (j <= lastPointOfContour) {
+        uint16_t k = 0; // position along the contour from start
+        while (k < count) {
 
-            uint16_t searchPoint = (j == lastPointOfContour) ? (firstPointOfContour) : (j + 1);
-            
-            pointsOfCurve[1].x = pBBTT->glyph.points[searchPoint].x;
-            pointsOfCurve[1].y = pBBTT->glyph.points[searchPoint].y;
+            uint16_t searchPoint = (k + 1 == count) ? 0 : (k + 1);
+            const ttPoint_t *pPoint = &pContour[(start + searchPoint < count) ? start + searchPoint : start + searchPoint - count];
 
-            if (pBBTT->glyph.points[searchPoint].flag & FLAG_ONCURVE) {
+            pointsOfCurve[1].x = pPoint->x;
+            pointsOfCurve[1].y = pPoint->y;
 
-                bbttAddLine(pBBTT, pointsOfCurve[0].x * pBBTT->characterSize / pBBTT->headTable.unitsPerEm + _x,
-                        (pBBTT->ascender - pointsOfCurve[0].y) * pBBTT->characterSize / pBBTT->headTable.unitsPerEm + _y,
-                        pointsOfCurve[1].x * pBBTT->characterSize / pBBTT->headTable.unitsPerEm + _x,
-                        (pBBTT->ascender - pointsOfCurve[1].y) * pBBTT->characterSize / pBBTT->headTable.unitsPerEm + _y);
+            if (pPoint->flag & FLAG_ONCURVE) {
+
+                bbttAddLine(pBBTT, pointsOfCurve[0].x * characterSize / pBBTT->headTable.unitsPerEm + _x,
+                        (pBBTT->ascender - pointsOfCurve[0].y) * characterSize / pBBTT->headTable.unitsPerEm + _y,
+                        pointsOfCurve[1].x * characterSize / pBBTT->headTable.unitsPerEm + _x,
+                        (pBBTT->ascender - pointsOfCurve[1].y) * characterSize / pBBTT->headTable.unitsPerEm + _y);
 
                 pointsOfCurve[0] = pointsOfCurve[1];
-                j += 1;
+                k += 1;
 
             } else {
 
-                searchPoint = (searchPoint == lastPointOfContour) ? (firstPointOfContour) : (searchPoint + 1);
+                searchPoint = (searchPoint + 1 == count) ? 0 : (searchPoint + 1);
+                pPoint = &pContour[(start + searchPoint < count) ? start + searchPoint : start + searchPoint - count];
 
-                if (pBBTT->glyph.points[searchPoint].flag & FLAG_ONCURVE) {
-                    pointsOfCurve[2].x = pBBTT->glyph.points[searchPoint].x;
-                    pointsOfCurve[2].y = pBBTT->glyph.points[searchPoint].y;
-                    j += 2;
+                if (pPoint->flag & FLAG_ONCURVE) {
+                    pointsOfCurve[2].x = pPoint->x;
+                    pointsOfCurve[2].y = pPoint->y;
+                    k += 2;
                 } else {
-                    pointsOfCurve[2].x = (pointsOfCurve[1].x + pBBTT->glyph.points[searchPoint].x) / 2;
-                    pointsOfCurve[2].y = (pointsOfCurve[1].y + pBBTT->glyph.points[searchPoint].y) / 2;
-                    j += 1;
-                }
-
-                x0 = pointsOfCurve[0].x;
-                y0 = pointsOfCurve[0].y;
-
-                for (int step = 0; step <= 9; step += 1) {
-                    float t = (float)step / 9.0;
-                    x1 = (1.0 - t) * (1.0 - t) * pointsOfCurve[0].x + 2.0 * t * (1.0 - t) * pointsOfCurve[1].x + t * t * pointsOfCurve[2].x;
-                    y1 = (1.0 - t) * (1.0 - t) * pointsOfCurve[0].y + 2.0 * t * (1.0 - t) * pointsOfCurve[1].y + t * t * pointsOfCurve[2].y;
-
-                    bbttAddLine(pBBTT, x0 * pBBTT->characterSize / pBBTT->headTable.unitsPerEm + _x, (pBBTT->ascender - y0) * pBBTT->characterSize / pBBTT->headTable.unitsPerEm + _y,
-                            x1 * pBBTT->characterSize / pBBTT->headTable.unitsPerEm + _x, (pBBTT->ascender - y1) * pBBTT->characterSize / pBBTT->headTable.unitsPerEm + _y);
-
-                    x0 = x1;
-                    y0 = y1;
+                    pointsOfCurve[2].x = (pointsOfCurve[1].x + pPoint->x) / 2;
+                    pointsOfCurve[2].y = (pointsOfCurve[1].y + pPoint->y) / 2;
+                    k += 1;
                 }
 
+                bbttAddCurve(pBBTT, pointsOfCurve, bbttCurveSteps(pBBTT, pointsOfCurve), _x, _y, characterSize, &scale);
                 pointsOfCurve[0] = pointsOfCurve[2];
 
             }
         }
+        j = lastPointOfContour + 1;
         pBBTT->endPoints[pBBTT->numEndPoints++] = pBBTT->numPoints - 1;
         pBBTT->beginPoints[pBBTT->numBeginPoints++] = pBBTT->numPoints;
     }
     return;
 }
 
-int32_t bbttIsLeft(ttCoordinate_t *_p0, ttCoordinate_t *_p1, ttCoordinate_t *_point) {
-    return ((_p1->x - _p0->x) * (_point->y - _p0->y) - (_point->x - _p0->x) * (_p1->y - _p0->y));
-}
+//
+// Outline of the current glyph in framebuffer pixels for a glyph origin at
+// framebuffer position ox, oy (16.16). Quarter turns and flips take pixels to
+// pixels, so their points are rounded exactly as they are without a
+// transform, then moved; a flipped axis counts pixels from the other side
+// (x -> w - 1 - x rather than w - x) so that each point stays on the pixel it
+// was on. The others are generated in sub-pixels and only rounded once
+// they're transformed
+//
+void bbttGenerateTransformed(BBTT *pBBTT, int32_t ox, int32_t oy)
+{
+    const ttTransform_t *t = &pBBTT->transform;
+
+    if (pBBTT->transformType == TRANSFORM_QUARTER) {
+        bbttGenerateOutline(pBBTT, 0, 0, pBBTT->characterSize);
+        if (t->xx < 0 || t->xy < 0) ox -= 65536;
+        if (t->yx < 0 || t->yy < 0) oy -= 65536;
+        bbttTransformOutline(pBBTT, ox, oy, 0, 0);
+    } else {
+        bbttGenerateOutline(pBBTT, 0, 0, pBBTT->characterSize << AA_SHIFT);
+        bbttTransformOutline(pBBTT, ox, oy, AA_SHIFT, 0);
+    }
+} /* bbttGenerateTransformed() */
+
+//
+// Pass the batched fill runs to the DrawSpans callback
+//
+void bbttFlushSpans(BBTT *pBBTT)
+{
+    if (pBBTT->numSpans) {
+        (*pBBTT->pfnDrawSpans)(pBBTT->spans, pBBTT->numSpans, pBBTT->colorInside);
+        pBBTT->numSpans = 0;
+    }
+} /* bbttFlushSpans() */
+
+void bbttFillSpan(BBTT *pBBTT, int16_t x1, int16_t x2, int16_t y)
+{
+    if (pBBTT->pCapture) { // rendering into the bitmap cache
+        ttBitmapCacheEntry_t *pCap = pBBTT->pCapture;
+        uint8_t *pRow = (uint8_t *)&pCap[1] + (y - pCap->yOffset) * pCap->pitch;
+        bbttWriteBits(pRow, x1 - pCap->xOffset, x2 - pCap->xOffset, 0xff);
+    } else if (pBBTT->pfnDrawSpans) {
+        ttSpan_t *pSpan = &pBBTT->spans[pBBTT->numSpans++];
+        pSpan->y = y;
+        pSpan->x0 = x1;
+        pSpan->x1 = x2;
+        if (pBBTT->numSpans == MAX_SPANS) {
+            bbttFlushSpans(pBBTT);
+        }
+    } else if (pBBTT->pfnDrawLine) {
+        (*pBBTT->pfnDrawLine)(x1, y, x2, y, pBBTT->colorInside);
+    } else {
+        bbttDrawSpan(pBBTT, x1, x2, y, pBBTT->colorInside);
+    }
+} /* bbttFillSpan() */
+
+//
+// Add the edge from p1 to p2 to the edge table
+// Horizontal edges never cross a scanline and are dropped, as are edges
+// outside of rows edgeTop to edgeBottom - 1 (see bbttBandEdges). Edges that
+// don't fit in the table (MAX_EDGES) are only counted
+//
+void bbttAddEdge(BBTT *pBBTT, const ttCoordinate_t *p1, const ttCoordinate_t *p2, uint16_t *pNumEdges)
+{
+    ttEdge_t *pE;
+
+    if (p1->y == p2->y) return;
+    if ((p1->y >= pBBTT->edgeBottom && p2->y >= pBBTT->edgeBottom) ||
+        (p1->y <= pBBTT->edgeTop && p2->y <= pBBTT->edgeTop)) return;
+    if (*pNumEdges >= MAX_EDGES) {
+        (*pNumEdges)++;
+        return;
+    }
+    pE = &pBBTT->edges[(*pNumEdges)++];
+    if (p1->y < p2->y) {
+        pE->dir = 1;
+    } else {
+        pE->dir = -1;
+        const ttCoordinate_t *pTemp = p1;
+        p1 = p2;
+        p2 = pTemp;
+    }
+    // x holds the starting column until the edge becomes active
+    pE->x = p1->x;
+    pE->y0 = p1->y;
+    pE->dy = p2->y - p1->y;
+    int32_t dx = p2->x - p1->x;
+    pE->xstep = dx / pE->dy;
+    int32_t rem = dx % pE->dy;
+    if (rem < 0) { // floor division
+        pE->xstep--;
+        rem += pE->dy;
+    }
+    pE->rstep = rem;
+} /* bbttAddEdge() */
+
+//
+// Nonzero when point p lies between the ends of the edge from a to b and
+// within iTol/16 outline units of it
+//
+int bbttNearEdge(const ttCoordinate_t *a, const ttCoordinate_t *b, const ttCoordinate_t *p, int32_t iTol)
+{
+    int32_t dx = b->x - a->x, dy = b->y - a->y;
+    int32_t px = p->x - a->x, py = p->y - a->y;
+    int64_t cross = (int64_t)dx * py - (int64_t)dy * px;
+    int64_t l1 = ((dx < 0) ? -dx : dx) + ((dy < 0) ? -dy : dy);
+
+    if (cross < 0) cross = -cross;
+    // the distance is cross / length and the length is at most |dx| + |dy|,
+    // which rules most points out without the squares
+    if (cross * 16 > iTol * l1) {
+        return 0;
+    }
+    int64_t len2 = (int64_t)dx * dx + (int64_t)dy * dy;
+    int64_t dot = (int64_t)dx * px + (int64_t)dy * py;
+    if (len2 == 0 || dot < 0 || dot > len2) { // a spike, not part of the edge
+        return 0;
+    }
+    return (uint64_t)(cross * cross) * 256 <= (uint64_t)(iTol * iTol) * len2;
+} /* bbttNearEdge() */
+
+//
+// Fill the edge table again, merging consecutive outline lines into one edge
+// when every point between them lies within iTol/16 outline units of it
+//
+uint16_t bbttMergeEdges(BBTT *pBBTT, int32_t iTol)
+{
+    uint16_t i, k, s = 0, p2Num, epCounter = 0, numEdges = 0;
+    const ttCoordinate_t *pPoints = pBBTT->points;
+
+    for (i = 0; i < pBBTT->numPoints; i++) {
+        // Wrap?
+        uint8_t bWrap = (i == pBBTT->endPoints[epCounter]);
+        p2Num = (bWrap) ? pBBTT->beginPoints[epCounter] : i + 1;
+        if (i != s) { // can the edge from point s reach p2Num instead of stopping at i?
+            k = i;
+            if (i - s < MAX_MERGE_POINTS) {
+                while (k > s && bbttNearEdge(&pPoints[s], &pPoints[p2Num], &pPoints[k], iTol)) {
+                    k--;
+                }
+            }
+            if (k != s) {
+                bbttAddEdge(pBBTT, &pPoints[s], &pPoints[i], &numEdges);
+                s = i;
+            }
+        }
+        if (bWrap) {
+            bbttAddEdge(pBBTT, &pPoints[s], &pPoints[p2Num], &numEdges);
+            epCounter++;
+            s = i + 1;
+        }
+    }
+    return numEdges;
+} /* bbttMergeEdges() */
+
+//
+// Fill the edge table from the generated outline, with its lines merged
+// within edgeTol if that's set
+// returns the number of edges, which can be more than the table holds
+//
+uint16_t bbttTableEdges(BBTT *pBBTT)
+{
+    uint16_t i, p2Num, epCounter = 0, numEdges = 0;
+
+    if (pBBTT->edgeTol) {
+        return bbttMergeEdges(pBBTT, pBBTT->edgeTol);
+    }
+    for (i = 0; i < pBBTT->numPoints; i++) {
+        // Wrap?
+        if (i == pBBTT->endPoints[epCounter]) {
+            p2Num = pBBTT->beginPoints[epCounter];
+            epCounter++;
+        } else {
+            p2Num = i + 1;
+        }
+        bbttAddEdge(pBBTT, &pBBTT->points[i], &pBBTT->points[p2Num], &numEdges);
+    }
+    return numEdges;
+} /* bbttTableEdges() */
+
+//
+// Sort the edge table by starting row so that edges can be activated in order
+// (a shell sort; contours are mostly in order already)
+//
+void bbttSortEdges(BBTT *pBBTT, uint16_t numEdges)
+{
+    uint16_t i;
+    ttEdge_t e;
+
+    for (uint16_t gap = numEdges / 2; gap > 0; gap /= 2) {
+        for (i = gap; i < numEdges; i++) {
+            e = pBBTT->edges[i];
+            uint16_t j = i;
+            while (j >= gap && pBBTT->edges[j - gap].y0 > e.y0) {
+                pBBTT->edges[j] = pBBTT->edges[j - gap];
+                j -= gap;
+            }
+            pBBTT->edges[j] = e;
+        }
+    }
+} /* bbttSortEdges() */
+
+//
+// Build the edge table from the generated outline
+// iUnit is the number of outline units per pixel (AA_ONE for the anti-aliased
+// outline) and iRows the height of the glyph in pixels
+// returns the number of edges; when that's more than MAX_EDGES, the table
+// is incomplete and the glyph has to be filled in bands (see bbttBandEdges)
+//
+uint16_t bbttBuildEdges(BBTT *pBBTT, int32_t iUnit, int32_t iRows)
+{
+    uint16_t numEdges;
+    int32_t iTol = pBBTT->curveTolerance;
+
+    pBBTT->edgeTop = INT16_MIN;
+    pBBTT->edgeBottom = INT16_MAX;
+    pBBTT->edgeTol = 0;
+    numEdges = bbttTableEdges(pBBTT);
+    // more edges per pixel row than MAX_ROW_EDGES? merge the lines which are
+    // close to straight, allowing more error each time up to 1/4 pixel
+    while (numEdges > iRows * MAX_ROW_EDGES && iTol <= 4) {
+        pBBTT->edgeTol = iTol * iUnit;
+        numEdges = bbttMergeEdges(pBBTT, pBBTT->edgeTol);
+        iTol *= 2;
+    }
+    pBBTT->outlineStats.u32Glyphs++;
+    pBBTT->outlineStats.u16LastEdges = numEdges;
+    pBBTT->outlineStats.u16LastRemoved = pBBTT->numPoints - numEdges;
+    pBBTT->outlineStats.u32Edges += numEdges;
+    pBBTT->outlineStats.u32EdgesRemoved += pBBTT->outlineStats.u16LastRemoved;
+    if (numEdges <= MAX_EDGES) {
+        bbttSortEdges(pBBTT, numEdges);
+    }
+    return numEdges;
+} /* bbttBuildEdges() */
 
+//
+// Rebuild the edge table for the band of rows from y to *pEnd - 1 (rows are
+// iUnit outline units high and an edge covers rows from y0 + iRowBias on)
+// An outline with more edges than the table holds is filled one band at a
+// time; the band is halved until its edges fit. Sets *pEnd to the row after
+// the band and returns its number of edges, or 0 for a single row that
+// still crosses more edges than MAX_EDGES (it's left empty)
+//
+uint16_t bbttBandEdges(BBTT *pBBTT, int16_t y, int16_t *pEnd, int32_t iUnit, int iRowBias)
+{
+    uint16_t numEdges;
+    int16_t yEnd = *pEnd;
+
+    for (;;) {
+        pBBTT->edgeTop = (int16_t)(y * iUnit - iRowBias);
+        pBBTT->edgeBottom = (int16_t)(yEnd * iUnit - iRowBias);
+        numEdges = bbttTableEdges(pBBTT);
+        if (numEdges <= MAX_EDGES) break;
+        if (yEnd - y == 1) {
+            numEdges = 0;
+            break;
+        }
+        yEnd = y + (yEnd - y) / 2;
+    }
+    bbttSortEdges(pBBTT, numEdges);
+    *pEnd = yEnd;
+    return numEdges;
+} /* bbttBandEdges() */
+
+// round(v * characterSize / unitsPerEm + offset), halves away from 0
+int16_t bbttScaleRound(BBTT *pBBTT, int32_t v, int16_t offset)
+{
+    int32_t upem = pBBTT->headTable.unitsPerEm;
+    int32_t n = 2 * (v * pBBTT->characterSize + offset * upem);
+
+    return (int16_t)((n >= 0) ? (n + upem) / (2 * upem) : -((upem - n) / (2 * upem)));
+} /* bbttScaleRound() */
+
+//
+// How the fill samples pixels under a quarter turn or flip
+// Without a transform a pixel is sampled just inside its top left corner,
+// nearer to the top edge than to the left one. Turned with the text, that
+// point lies inside another corner of the framebuffer pixel; sampling there
+// gives the text the pixels it has unturned. Returns 1 if rows are sampled
+// just above their top edge and sets pTies[] (see ttEdge_t) for edges
+// leaning left, upright and leaning right
+//
+int bbttQuarterSampling(BBTT *pBBTT, uint8_t *pTies)
+{
+    const ttTransform_t *t = &pBBTT->transform;
+
+    if (pBBTT->transformType != TRANSFORM_QUARTER) {
+        pTies[0] = pTies[1] = pTies[2] = 0;
+        return 0;
+    }
+    if (t->xy == 0) { // x stays x; the sample is furthest from the left/right edge
+        pTies[0] = pTies[1] = pTies[2] = (t->xx < 0);
+        return (t->yy < 0);
+    }
+    // x and y swap; the sample is furthest from the top/bottom edge, so
+    // whether it's left or right of a crossing depends on the edge's lean
+    pTies[0] = (t->yx < 0);
+    pTies[1] = (t->xy < 0);
+    pTies[2] = (t->yx > 0);
+    return (t->yx < 0);
+} /* bbttQuarterSampling() */
+
+// pixel box filled by bbttFillGlyph() (xe and ye are exclusive)
+void bbttGetFillBox(BBTT *pBBTT, int16_t _x_min, int16_t _y_min, int16_t *pXS, int16_t *pYS, int16_t *pXE, int16_t *pYE)
+{
+    if (pBBTT->transformType == TRANSFORM_QUARTER) {
+        // the box without the transform, turned; pixel i of the text becomes
+        // pixel origin + i, or origin - 1 - i on a flipped axis
+        const ttTransform_t *t = &pBBTT->transform;
+        int16_t iStart[2], iEnd[2]; // text x and y ranges
+        int iAxis = (t->xy != 0); // text axis that becomes x
+        iStart[0] = bbttScaleRound(pBBTT, pBBTT->glyph.xMin, 0);
+        iEnd[0] = bbttScaleRound(pBBTT, pBBTT->glyph.xMax, 0);
+        iStart[1] = bbttScaleRound(pBBTT, pBBTT->ascender - pBBTT->glyph.yMax, 0);
+        iEnd[1] = bbttScaleRound(pBBTT, pBBTT->ascender - pBBTT->glyph.yMin, 0);
+        int32_t cx = (iAxis) ? t->xy : t->xx, cy = (iAxis) ? t->yx : t->yy;
+        *pXS = (cx > 0) ? _x_min + iStart[iAxis] : _x_min - iEnd[iAxis];
+        *pXE = (cx > 0) ? _x_min + iEnd[iAxis] : _x_min - iStart[iAxis];
+        *pYS = (cy > 0) ? _y_min + iStart[1 - iAxis] : _y_min - iEnd[1 - iAxis];
+        *pYE = (cy > 0) ? _y_min + iEnd[1 - iAxis] : _y_min - iStart[1 - iAxis];
+        return;
+    }
+    if (pBBTT->transformType != TRANSFORM_NONE) { // the glyph's box doesn't apply; use the points
+        int16_t xMin = INT16_MAX, yMin = INT16_MAX, xMax = INT16_MIN, yMax = INT16_MIN;
+        for (uint16_t i = 0; i < pBBTT->numPoints; i++) {
+            if (pBBTT->points[i].x < xMin) xMin = pBBTT->points[i].x;
+            if (pBBTT->points[i].x > xMax) xMax = pBBTT->points[i].x;
+            if (pBBTT->points[i].y < yMin) yMin = pBBTT->points[i].y;
+            if (pBBTT->points[i].y > yMax) yMax = pBBTT->points[i].y;
+        }
+        if (pBBTT->numPoints == 0) {
+            xMin = xMax = yMin = yMax = 0;
+        }
+        *pXS = xMin;
+        *pYS = yMin;
+        *pXE = xMax;
+        *pYE = yMax;
+        return;
+    }
+    *pYS = bbttScaleRound(pBBTT, pBBTT->ascender - pBBTT->glyph.yMax, _y_min);
+    *pYE = bbttScaleRound(pBBTT, pBBTT->ascender - pBBTT->glyph.yMin, _y_min);
+    *pXS = _x_min + bbttScaleRound(pBBTT, pBBTT->glyph.xMin, 0);
+    *pXE = _x_min + bbttScaleRound(pBBTT, pBBTT->glyph.xMax, 0);
+} /* bbttGetFillBox() */
+
+//
+// Scanline fill using an active edge table
+// A pixel is inside when the nonzero winding number of the edges whose
+// crossing lies to its right is not zero. An edge crossing at x + r/dy
+// covers every pixel left of ceil(x + r/dy), or of floor(x + r/dy) + 1 when
+// its tie is set (see bbttQuarterSampling).
+//
 void bbttFillGlyph(BBTT *pBBTT, int16_t _x_min, int16_t _y_min, uint16_t characterSize) {
-    ttWindIntersect_t pointsToFill[16];
-    int16_t ys = round((float)(pBBTT->ascender - pBBTT->glyph.yMax) * (float)pBBTT->characterSize / (float)pBBTT->headTable.unitsPerEm + _y_min);
-    int16_t ye = round((float)(pBBTT->ascender - pBBTT->glyph.yMin) * (float)pBBTT->characterSize / (float)pBBTT->headTable.unitsPerEm + _y_min);
-    int16_t xs = _x_min + round((float)pBBTT->glyph.xMin * (float)pBBTT->characterSize / (float)pBBTT->headTable.unitsPerEm);
-    int16_t xe = _x_min + round((float)pBBTT->glyph.xMax * (float)pBBTT->characterSize / (float)pBBTT->headTable.unitsPerEm);
+    int16_t xs, ys, xe, ye;
+    bbttGetFillBox(pBBTT, _x_min, _y_min, &xs, &ys, &xe, &ye);
+    uint16_t numEdges = bbttBuildEdges(pBBTT, 1, ye - ys);
+    uint16_t nextEdge = 0, numActive = 0;
+    uint16_t *pActive = pBBTT->activeEdges;
+    ttEdge_t *pEdges = pBBTT->edges;
+    uint8_t ucTies[3];
+    // edges cover rows y0 + iRowBias to y0 + dy + iRowBias - 1
+    int iRowBias = bbttQuarterSampling(pBBTT, ucTies);
+    // the table holds the edges of rows up to yBand - 1
+    int16_t yBand = (numEdges > MAX_EDGES) ? ys : ye, iBand = ye - ys;
+
     for (int16_t y = ys; y < ye; y++) {
-        ttCoordinate_t *p1, *p2;
-        ttCoordinate_t point;
-        int16_t p1_y, p2_y;
-        point.y = y;
+        uint16_t i, j;
+        ttEdge_t *pE;
+        if (y == yBand) { // too many edges for the table; fill the next band of rows
+            yBand = (iBand > ye - y) ? ye : y + iBand;
+            numEdges = bbttBandEdges(pBBTT, y, &yBand, 1, iRowBias);
+            iBand = yBand - y;
+            nextEdge = numActive = 0;
+        }
+        // retire finished edges and step the rest to this row
+        for (i = j = 0; i < numActive; i++) {
+            pE = &pEdges[pActive[i]];
+            if (pE->y0 + pE->dy + iRowBias <= y) continue;
+            pE->x += pE->xstep;
+            pE->r += pE->rstep;
+            if (pE->r >= pE->dy) {
+                pE->r -= pE->dy;
+                pE->x++;
+            }
+            pActive[j++] = pActive[i];
+        }
+        numActive = j;
+        // activate edges which start on (or before) this row
+        while (nextEdge < numEdges && pEdges[nextEdge].y0 + iRowBias <= y) {
+            pE = &pEdges[nextEdge];
+            if (pE->y0 + pE->dy + iRowBias > y) {
+                int32_t num = ((int32_t)pE->xstep * pE->dy + pE->rstep) * (y - pE->y0);
+                int32_t q = num / pE->dy;
+                int32_t rem = num % pE->dy;
+                if (rem < 0) {
+                    q--;
+                    rem += pE->dy;
+                }
+                pE->x += q;
+                pE->r = rem;
+                pE->tie = ucTies[(pE->xstep < 0) ? 0 : (pE->xstep | pE->rstep) ? 2 : 1];
+                pActive[numActive++] = nextEdge;
+            }
+            nextEdge++;
+        }
+        if (numActive == 0) continue;
+        // keep the active list sorted by crossing; it changes little from row to row
+        int16_t iWinding = 0;
+        for (i = 1; i < numActive; i++) {
+            uint16_t u = pActive[i];
+            int16_t c = pEdges[u].x + ((pEdges[u].r | pEdges[u].tie) != 0);
+            for (j = i; j > 0; j--) {
+                pE = &pEdges[pActive[j - 1]];
+                if (pE->x + ((pE->r | pE->tie) != 0) <= c) break;
+                pActive[j] = pActive[j - 1];
+            }
+            pActive[j] = u;
+        }
+        for (i = 0; i < numActive; i++) {
+            iWinding += pEdges[pActive[i]].dir;
+        }
+        // walk the crossings left to right and emit the runs of nonzero winding
+        // (any x can start a segment, even a negative one, so a flag tells
+        // whether one is open)
+        int16_t iStartPoint = 0; // start of each horizontal line segment
+        uint8_t bInSegment = 0;
+        int16_t x = xs;
+        for (i = 0; i <= numActive && x < xe; i++) {
+            int16_t c = xe;
+            if (i < numActive) {
+                pE = &pEdges[pActive[i]];
+                c = pE->x + ((pE->r | pE->tie) != 0);
+                if (c > xe) c = xe;
+            }
+            if (c > x) { // pixels x..c-1 share the same winding number
+                if (iWinding != 0) {
+                    if (!bInSegment) { // start of a new line?
+                        iStartPoint = x;
+                        bInSegment = 1;
+                    }
+                } else if (bInSegment) { // finishing a line segment?
+                    bbttFillSpan(pBBTT, iStartPoint, x-1, y);
+                    bInSegment = 0; // reset for next time
+                }
+                x = c;
+            }
+            if (i < numActive) {
+                iWinding -= pE->dir;
+            }
+        }
+        if (bInSegment) {
+            bbttFillSpan(pBBTT, iStartPoint, x-1, y);
+        }
+    }
+    if (pBBTT->pfnDrawSpans) {
+        bbttFlushSpans(pBBTT);
+    }
+} /* bbttFillGlyph() */
 
-        uint16_t intersectPointsNum = 0;
-        uint16_t epCounter = 0;
-        uint16_t p2Num = 0;
+//
+// Anti-aliased fill
+// The outline is generated in 1/AA_ONE pixel units relative to the glyph origin.
+// Each row accumulates the signed area covered by the edges crossing it
+// (the area of every line piece inside a pixel, plus the cover it adds to
+// all of the pixels to its right). A running sum then gives the exact
+// coverage of each pixel in units of 2*AA_ONE*AA_ONE.
+//
+void bbttAccumCell(int32_t *pAccum, int16_t ex, int32_t fx1, int32_t fx2, int32_t dy)
+{
+    int32_t area = dy * (fx1 + fx2);
+    pAccum[ex] += dy * (2 * AA_ONE) - area;
+    pAccum[ex + 1] += area;
+} /* bbttAccumCell() */
 
-        for (uint16_t i = 0; i < pBBTT->numPoints; i++) {
-            p1_y = pBBTT->points[i].y;
-            // Wrap?
-            if (i == pBBTT->endPoints[epCounter]) {
-                p2Num = pBBTT->beginPoints[epCounter];
-                epCounter++;
+// accumulate a line piece which lies within one row (y relative to the top of the row)
+void bbttAccumRow(int32_t *pAccum, int32_t xa, int32_t ya, int32_t xb, int32_t yb)
+{
+    int16_t ex1 = xa >> AA_SHIFT, ex2 = xb >> AA_SHIFT;
+
+    if (ya == yb) return;
+    if (ex1 == ex2) {
+        bbttAccumCell(pAccum, ex1, xa - (ex1 << AA_SHIFT), xb - (ex1 << AA_SHIFT), yb - ya);
+        return;
+    }
+    // the piece crosses pixel boundaries, split it at each one
+    int32_t dx = xb - xa, dy = yb - ya;
+    int32_t x = xa, y = ya;
+    int16_t ex = ex1;
+    while (ex != ex2) {
+        int32_t xBound = (dx > 0) ? ((ex + 1) << AA_SHIFT) : (ex << AA_SHIFT);
+        int32_t yBound = ya + (dy * (xBound - xa)) / dx;
+        bbttAccumCell(pAccum, ex, x - (ex << AA_SHIFT), xBound - (ex << AA_SHIFT), yBound - y);
+        x = xBound;
+        y = yBound;
+        ex += (dx > 0) ? 1 : -1;
+    }
+    bbttAccumCell(pAccum, ex2, x - (ex2 << AA_SHIFT), xb - (ex2 << AA_SHIFT), yb - y);
+} /* bbttAccumRow() */
+
+//
+// Draw one row of alpha values (0-15 or 0-255 depending on the mode)
+//
+void bbttDrawAlphaRow(BBTT *pBBTT, int16_t _x, int16_t _y, uint8_t *pAlpha, int16_t iCount)
+{
+    int16_t i;
+
+    if (pBBTT->pfnDrawAlpha) {
+        (*pBBTT->pfnDrawAlpha)(_x, _y, iCount, pAlpha, pBBTT->colorInside);
+    } else if (pBBTT->pfnDrawSpans || pBBTT->pfnDrawLine) {
+        // no alpha output available, use the 50% coverage threshold
+        uint8_t ucHalf = (pBBTT->antialias == TEXT_AA_4BIT) ? 8 : 128;
+        int16_t iStartPoint = -1;
+        for (i = 0; i <= iCount; i++) {
+            if (i < iCount && pAlpha[i] >= ucHalf) {
+                if (iStartPoint == -1) iStartPoint = i;
+            } else if (iStartPoint >= 0) {
+                bbttFillSpan(pBBTT, _x + iStartPoint, _x + i - 1, _y);
+                iStartPoint = -1;
+            }
+        }
+    } else {
+        for (i = 0; i < iCount; i++) {
+            uint8_t a = pAlpha[i];
+            if (a == 0) continue;
+            if (pBBTT->antialias == TEXT_AA_4BIT) a *= 17;
+            bbttDrawPixelAlpha(pBBTT, _x + i, _y, pBBTT->colorInside, a);
+        }
+    }
+} /* bbttDrawAlphaRow() */
+
+//
+// Pixel box of the anti-aliased outline (relative to the glyph origin)
+// returns 0 for an empty outline
+//
+int bbttGetAABox(BBTT *pBBTT, int16_t *pX, int16_t *pY, int16_t *pWidth, int16_t *pHeight)
+{
+    int16_t xMin = INT16_MAX, yMin = INT16_MAX, xMax = INT16_MIN, yMax = INT16_MIN;
+
+    if (pBBTT->numPoints == 0) return 0;
+    for (uint16_t i = 0; i < pBBTT->numPoints; i++) {
+        if (pBBTT->points[i].x < xMin) xMin = pBBTT->points[i].x;
+        if (pBBTT->points[i].x > xMax) xMax = pBBTT->points[i].x;
+        if (pBBTT->points[i].y < yMin) yMin = pBBTT->points[i].y;
+        if (pBBTT->points[i].y > yMax) yMax = pBBTT->points[i].y;
+    }
+    *pX = xMin >> AA_SHIFT;
+    *pY = yMin >> AA_SHIFT;
+    *pHeight = ((yMax + AA_ONE - 1) >> AA_SHIFT) - *pY;
+    *pWidth = ((xMax + AA_ONE - 1) >> AA_SHIFT) - *pX;
+    if (*pWidth > pBBTT->aaWidth) *pWidth = pBBTT->aaWidth;
+    return 1;
+} /* bbttGetAABox() */
+
+void bbttFillGlyphAA(BBTT *pBBTT, int16_t _x, int16_t _y)
+{
+    int16_t px0, py0, iWidth, iHeight;
+    uint16_t i, j;
+
+    if (!bbttGetAABox(pBBTT, &px0, &py0, &iWidth, &iHeight)) return;
+    int16_t py1 = py0 + iHeight;
+    int32_t xClip = (int32_t)iWidth << AA_SHIFT;
+    int32_t xOrigin = (int32_t)px0 * AA_ONE;
+
+    uint16_t numEdges = bbttBuildEdges(pBBTT, AA_ONE, iHeight);
+    uint16_t nextEdge = 0, numActive = 0;
+    uint16_t *pActive = pBBTT->activeEdges;
+    ttEdge_t *pEdges = pBBTT->edges;
+    int32_t *pAccum = pBBTT->aaAccum;
+    uint8_t *pAlpha = pBBTT->aaRow;
+    // the table holds the edges of rows up to yBand - 1
+    int16_t yBand = (numEdges > MAX_EDGES) ? py0 : py1, iBand = iHeight;
+
+    for (int16_t y = py0; y < py1; y++) {
+        int32_t yTop = (int32_t)y * AA_ONE;
+        int32_t yBot = yTop + AA_ONE;
+        ttEdge_t *pE;
+        if (y == yBand) { // too many edges for the table; fill the next band of rows
+            yBand = (iBand > py1 - y) ? py1 : y + iBand;
+            numEdges = bbttBandEdges(pBBTT, y, &yBand, AA_ONE, 0);
+            iBand = yBand - y;
+            nextEdge = numActive = 0;
+        }
+        // retire finished edges and activate the ones which reach this row
+        for (i = j = 0; i < numActive; i++) {
+            if (pEdges[pActive[i]].y0 + pEdges[pActive[i]].dy > yTop) {
+                pActive[j++] = pActive[i];
+            }
+        }
+        numActive = j;
+        while (nextEdge < numEdges && pEdges[nextEdge].y0 < yBot) {
+            if (pEdges[nextEdge].y0 + pEdges[nextEdge].dy > yTop) {
+                pActive[numActive++] = nextEdge;
+            }
+            nextEdge++;
+        }
+        if (numActive == 0) continue;
+        memset(pAccum, 0, (iWidth + 2) * sizeof(int32_t));
+        for (i = 0; i < numActive; i++) {
+            pE = &pEdges[pActive[i]];
+            // x still holds the starting column; edges are not stepped in this mode
+            int32_t dx = (int32_t)pE->xstep * pE->dy + pE->rstep;
+            int32_t ya = (pE->y0 > yTop) ? pE->y0 : yTop;
+            int32_t yb = pE->y0 + pE->dy;
+            if (yb > yBot) yb = yBot;
+            int32_t xa = pE->x + (dx * (ya - pE->y0)) / pE->dy - xOrigin;
+            int32_t xb = pE->x + (dx * (yb - pE->y0)) / pE->dy - xOrigin;
+            if (xa > xClip) xa = xClip;
+            if (xb > xClip) xb = xClip;
+            if (pE->dir > 0) {
+                bbttAccumRow(pAccum, xa, ya - yTop, xb, yb - yTop);
             } else {
-                p2Num = i + 1;
+                bbttAccumRow(pAccum, xb, yb - yTop, xa, ya - yTop);
             }
-            p2_y = pBBTT->points[p2Num].y;
-
-            if (p1_y <= y) {
-                if (p2_y > y) {
-                    // Have a valid up intersect
-                    pointsToFill[intersectPointsNum].p1 = &pBBTT->points[i];
-                    pointsToFill[intersectPointsNum].p2 = &pBBTT->points[p2Num];
-                    pointsToFill[intersectPointsNum].up = 1;
-                    intersectPointsNum++;
-                }
+        }
+        // convert the coverage to alpha values and trim the empty ends
+        int32_t iSum = 0;
+        int16_t iFirst = -1, iLast = -1;
+        for (i = 0; i < iWidth; i++) {
+            iSum += pAccum[i];
+            int32_t a = (iSum < 0) ? -iSum : iSum;
+            if (a > 2 * AA_ONE * AA_ONE) a = 2 * AA_ONE * AA_ONE;
+            if (pBBTT->antialias == TEXT_AA_4BIT) {
+                a = (a * 15 + AA_ONE * AA_ONE) / (2 * AA_ONE * AA_ONE);
+            } else {
+                a = (a * 255) / (2 * AA_ONE * AA_ONE);
+            }
+            pAlpha[i] = (uint8_t)a;
+            if (a) {
+                if (iFirst < 0) iFirst = i;
+                iLast = i;
+            }
+        }
+        if (pBBTT->pCapture) { // rendering into the bitmap cache
+            ttBitmapCacheEntry_t *pCap = pBBTT->pCapture;
+            uint8_t *pRow = (uint8_t *)&pCap[1] + (y - pCap->yOffset) * pCap->pitch;
+            if (pCap->bpp == 8) {
+                memcpy(pRow, pAlpha, iWidth);
             } else {
-                // start y > point.y (no test needed)
-                if (p2_y <= y) {
-                    // Have a valid down intersect
-                    pointsToFill[intersectPointsNum].p1 = &pBBTT->points[i];
-                    pointsToFill[intersectPointsNum].p2 = &pBBTT->points[p2Num];
-                    pointsToFill[intersectPointsNum].up = 0;
-                    intersectPointsNum++;
+                for (i = 0; i < iWidth; i += 2) {
+                    pRow[i / 2] = (pAlpha[i] << 4) | ((i + 1 < iWidth) ? pAlpha[i + 1] : 0);
                 }
             }
+            continue;
+        }
+        if (iFirst < 0) continue;
+        bbttDrawAlphaRow(pBBTT, _x + px0 + iFirst, _y + y, &pAlpha[iFirst], iLast - iFirst + 1);
+    }
+    if (pBBTT->pfnDrawSpans) {
+        bbttFlushSpans(pBBTT);
+    }
+    // leave the outline in pixel co-ordinates for bbttDrawOutline()
+    for (i = 0; i < pBBTT->numPoints; i++) {
+        pBBTT->points[i].x = (pBBTT->points[i].x >> AA_SHIFT) + _x;
+        pBBTT->points[i].y = (pBBTT->points[i].y >> AA_SHIFT) + _y;
+    }
+} /* bbttFillGlyphAA() */
+
+//
+// Rendered glyph bitmap cache
+// Entries are keyed by glyph, character size and fill mode. The bitmaps are
+// transformed (a new transform clears the cache); color is applied when
+// they're drawn.
+//
+void bbttSetBitmapCache(BBTT *pBBTT, uint8_t *pBuffer, uint32_t u32Size)
+{
+    bbttCacheInit(&pBBTT->bitmapCache, pBuffer, u32Size);
+} /* bbttSetBitmapCache() */
+
+// the cache holds fills only; glyphs with a separate outline color are drawn directly
+// and so is text with a transform that doesn't move in whole pixels
+int bbttUseBitmapCache(BBTT *pBBTT)
+{
+    return (pBBTT->bitmapCache.pBuffer && pBBTT->colorInside != COLOR_NONE &&
+            (pBBTT->colorLine == COLOR_NONE || pBBTT->colorLine == pBBTT->colorInside) &&
+            pBBTT->transformType != TRANSFORM_ANY); // other glyph origins fall between pixels
+} /* bbttUseBitmapCache() */
+
+ttBitmapCacheEntry_t *bbttFindCachedBitmap(BBTT *pBBTT, uint16_t _code)
+{
+    ttCache_t *pCache = &pBBTT->bitmapCache;
+    uint8_t bpp = (pBBTT->antialias) ? pBBTT->antialias : 1;
+    uint32_t u32Off = 0;
+
+    while (u32Off < pCache->u32Used) {
+        ttBitmapCacheEntry_t *pEntry = (ttBitmapCacheEntry_t *)&pCache->pBuffer[u32Off];
+        if (pEntry->glyphId == _code && pEntry->characterSize == pBBTT->characterSize && pEntry->bpp == bpp) {
+            pEntry->hdr.lastUsed = pCache->u32Clock++;
+            pCache->stats.hits++;
+            return pEntry;
+        }
+        u32Off += pEntry->hdr.size;
+    }
+    pCache->stats.misses++;
+    return NULL;
+} /* bbttFindCachedBitmap() */
+
+//
+// Render the current glyph at the origin into a new cache entry
+// returns NULL if it doesn't fit in the cache
+//
+ttBitmapCacheEntry_t *bbttRenderCachedBitmap(BBTT *pBBTT, uint16_t _code)
+{
+    ttBitmapCacheEntry_t *pEntry;
+    int16_t x, y, w, h, xe, ye;
+    uint8_t bpp;
+
+    if (pBBTT->antialias) {
+        bpp = pBBTT->antialias;
+        bbttGenerateOutline(pBBTT, 0, 0, pBBTT->characterSize << AA_SHIFT);
+        if (pBBTT->transformType != TRANSFORM_NONE) {
+            bbttTransformOutline(pBBTT, 0, 0, AA_SHIFT, 1);
+        }
+        if (!bbttGetAABox(pBBTT, &x, &y, &w, &h)) {
+            x = y = w = h = 0;
+        }
+    } else if (pBBTT->transformType != TRANSFORM_NONE) {
+        bpp = 1;
+        bbttGenerateTransformed(pBBTT, 0, 0);
+        bbttGetFillBox(pBBTT, 0, 0, &x, &y, &xe, &ye);
+        w = xe - x;
+        h = ye - y;
+    } else {
+        bpp = 1;
+        bbttGenerateOutline(pBBTT, 0, 0, pBBTT->characterSize);
+        bbttGetFillBox(pBBTT, 0, 0, &x, &y, &xe, &ye);
+        w = xe - x;
+        h = ye - y;
+    }
+    if (w < 0) w = 0;
+    if (h < 0) h = 0;
+    uint16_t pitch = (w * bpp + 7) / 8;
+    pEntry = (ttBitmapCacheEntry_t *)bbttCacheAlloc(&pBBTT->bitmapCache, sizeof(ttBitmapCacheEntry_t) + pitch * h);
+    if (pEntry == NULL) {
+        return NULL;
+    }
+    pEntry->glyphId = _code;
+    pEntry->metricsId = pBBTT->charCode;
+    pEntry->characterSize = pBBTT->characterSize;
+    pEntry->bpp = bpp;
+    pEntry->reserved = 0;
+    pEntry->xOffset = x;
+    pEntry->yOffset = y;
+    pEntry->width = w;
+    pEntry->height = h;
+    pEntry->pitch = pitch;
+    memset(&pEntry[1], 0, pitch * h);
+    if (w && h) {
+        pBBTT->pCapture = pEntry;
+        if (bpp == 1) {
+            bbttFillGlyph(pBBTT, 0, 0, pBBTT->characterSize);
+        } else {
+            bbttFillGlyphAA(pBBTT, 0, 0);
+        }
+        pBBTT->pCapture = NULL;
+    }
+    return pEntry;
+} /* bbttRenderCachedBitmap() */
+
+void bbttDrawCachedBitmap(BBTT *pBBTT, ttBitmapCacheEntry_t *pEntry, int16_t _x, int16_t _y)
+{
+    uint8_t *pRow = (uint8_t *)&pEntry[1];
+    int16_t x = _x + pEntry->xOffset;
+    int16_t y = _y + pEntry->yOffset;
+    int16_t i, iRow;
+
+    if (pBBTT->pfnDrawBitmap) {
+        if (pEntry->width && pEntry->height) {
+            (*pBBTT->pfnDrawBitmap)(x, y, pEntry->width, pEntry->height, pEntry->bpp, pEntry->pitch, pRow, pBBTT->colorInside);
+        }
+        return;
+    }
+    for (iRow = 0; iRow < pEntry->height; iRow++, pRow += pEntry->pitch) {
+        if (pEntry->bpp == 1) { // emit the runs of set bits
+            int16_t iStartPoint = -1;
+            for (i = 0; i <= pEntry->width; i++) {
+                if (i < pEntry->width && (pRow[i >> 3] & (0x80 >> (i & 7)))) {
+                    if (iStartPoint == -1) iStartPoint = i;
+                } else if (iStartPoint >= 0) {
+                    bbttFillSpan(pBBTT, x + iStartPoint, x + i - 1, y + iRow);
+                    iStartPoint = -1;
+                }
+            }
+        } else {
+            uint8_t *pAlpha = pBBTT->aaRow;
+            int16_t iFirst = -1, iLast = -1;
+            for (i = 0; i < pEntry->width && i < pBBTT->aaWidth; i++) { // (the buffer may have shrunk since)
+                if (pEntry->bpp == 8) {
+                    pAlpha[i] = pRow[i];
+                } else {
+                    pAlpha[i] = (i & 1) ? (pRow[i >> 1] & 0xf) : (pRow[i >> 1] >> 4);
+                }
+                if (pAlpha[i]) {
+                    if (iFirst < 0) iFirst = i;
+                    iLast = i;
+                }
+            }
+            if (iFirst >= 0) {
+                bbttDrawAlphaRow(pBBTT, x + iFirst, y + iRow, &pAlpha[iFirst], iLast - iFirst + 1);
+            }
+        }
+    }
+    if (pBBTT->pfnDrawSpans) {
+        bbttFlushSpans(pBBTT);
+    }
+} /* bbttDrawCachedBitmap() */
+
+//
+// String prefetch
+// On a file font each glyph record costs a seek and a read, in whatever order
+// the string has them. The records of a string are read once, sorted by
+// offset, into the staging buffer and bbttGetRecord serves them from there.
+// The glyph ids and record offsets found on the way are kept for the drawing,
+// in lists at the start of the buffer; a buffer too small to hold them and
+// some records (or NULL) turns the prefetch off
+//
+void bbttSetPrefetchBuffer(BBTT *pBBTT, uint8_t *pBuffer, uint32_t u32Size)
+{
+    uint32_t u32Align = (pBuffer) ? ((0 - (uintptr_t)pBuffer) & 3) : 0;
+
+    if (pBuffer == NULL || u32Size <= u32Align + PREFETCH_TABLE_SIZE) {
+        pBuffer = NULL;
+        u32Size = 0;
+    } else {
+        pBuffer += u32Align;
+        u32Size -= u32Align + PREFETCH_TABLE_SIZE;
+    }
+    pBBTT->prefetch = (ttPrefetch_t *)pBuffer;
+    pBBTT->prefetchGlyphs = (pBuffer) ? (ttPrefetchGlyph_t *)&pBBTT->prefetch[MAX_PREFETCH_GLYPHS] : NULL;
+    pBBTT->pPrefetchBuf = (pBuffer) ? (uint8_t *)&pBBTT->prefetchGlyphs[MAX_PREFETCH_GLYPHS] : NULL;
+    pBBTT->u32PrefetchSize = u32Size;
+    pBBTT->iPrefetchCount = pBBTT->iPrefetchGlyphs = 0;
+    pBBTT->u32PrefetchUsed = 0;
+} /* bbttSetPrefetchBuffer() */
+
+//
+// Check the outline and bitmap caches for a glyph without changing their LRU order
+//
+int bbttIsCached(BBTT *pBBTT, uint16_t _code)
+{
+    ttCache_t *pCache = &pBBTT->glyphCache;
+    uint8_t bpp = (pBBTT->antialias) ? pBBTT->antialias : 1;
+    uint32_t u32Off = 0;
+
+    while (u32Off < pCache->u32Used) {
+        ttGlyphCacheEntry_t *pEntry = (ttGlyphCacheEntry_t *)&pCache->pBuffer[u32Off];
+        if (pEntry->glyphId == _code) {
+            return 1;
+        }
+        u32Off += pEntry->hdr.size;
+    }
+    if (bbttUseBitmapCache(pBBTT)) {
+        pCache = &pBBTT->bitmapCache;
+        u32Off = 0;
+        while (u32Off < pCache->u32Used) {
+            ttBitmapCacheEntry_t *pEntry = (ttBitmapCacheEntry_t *)&pCache->pBuffer[u32Off];
+            if (pEntry->glyphId == _code && pEntry->characterSize == pBBTT->characterSize && pEntry->bpp == bpp) {
+                return 1;
+            }
+            u32Off += pEntry->hdr.size;
+        }
+    }
+    return 0;
+} /* bbttIsCached() */
+
+//
+// Remember a character of the string (or a component glyph) unless it's
+// already listed. A cached glyph only needs its glyph id; its record isn't read
+//
+void bbttAddPrefetchGlyph(BBTT *pBBTT, uint32_t _code, uint16_t _glyphId, int bCached)
+{
+    ttPrefetchGlyph_t *pGlyph;
+
+    if (pBBTT->iPrefetchGlyphs >= MAX_PREFETCH_GLYPHS) {
+        return;
+    }
+    for (int i = 0; i < pBBTT->iPrefetchGlyphs; i++) {
+        pGlyph = &pBBTT->prefetchGlyphs[i];
+        if ((_code != 0xffffffff) ? (pGlyph->code == _code) : (pGlyph->glyphId == _glyphId && pGlyph->offset)) {
+            return;
+        }
+    }
+    pGlyph = &pBBTT->prefetchGlyphs[pBBTT->iPrefetchGlyphs];
+    pGlyph->offset = pGlyph->length = 0;
+    if (!bCached) {
+        pGlyph->offset = bbttGetGlyphOffset(pBBTT, _glyphId, &pGlyph->length);
+    }
+    pGlyph->code = _code;
+    pGlyph->glyphId = _glyphId;
+    pBBTT->iPrefetchGlyphs++; // after bbttGetGlyphOffset; it searches the list
+} /* bbttAddPrefetchGlyph() */
+
+/* sort pieces by offset; there are only a few dozen */
+void bbttSortPrefetch(ttPrefetch_t *pList, int iCount)
+{
+    for (int i = 1; i < iCount; i++) {
+        ttPrefetch_t t = pList[i];
+        int j = i;
+        for (; j > 0 && pList[j - 1].offset > t.offset; j--) {
+            pList[j] = pList[j - 1];
+        }
+        pList[j] = t;
+    }
+} /* bbttSortPrefetch() */
+
+//
+// Read the records of prefetchGlyphs[iFirst..] in offset order into the staging
+// buffer. Records less than MAX_PREFETCH_GAP apart share one read unless an
+// earlier piece lies between them. A record that doesn't fit (or is empty) is
+// left to be read when it's drawn
+//
+void bbttStageRecords(BBTT *pBBTT, int iFirst)
+{
+    ttPrefetch_t list[MAX_PREFETCH_GLYPHS];
+    ttPrefetch_t *pPiece = NULL;
+    int i, j, iCount = 0, iStaged = pBBTT->iPrefetchCount;
+    uint32_t u32Free = pBBTT->u32PrefetchSize - pBBTT->u32PrefetchUsed;
+
+    for (i = iFirst; i < pBBTT->iPrefetchGlyphs; i++) {
+        ttPrefetchGlyph_t *pGlyph = &pBBTT->prefetchGlyphs[i];
+        if (pGlyph->length >= 10 && pGlyph->length <= u32Free && !bbttFindPrefetch(pBBTT, pGlyph->offset, pGlyph->length)) {
+            list[iCount].offset = pGlyph->offset;
+            list[iCount++].length = pGlyph->length;
+        }
+    }
+    bbttSortPrefetch(list, iCount);
+    for (i = 0; i < iCount; i++) {
+        uint32_t u32End = list[i].offset + list[i].length;
+        if (pPiece) {
+            uint32_t u32PieceEnd = pPiece->offset + pPiece->length;
+            if (u32End <= u32PieceEnd) {
+                continue; // the same record (or a bad loca)
+            }
+            if (list[i].offset <= u32PieceEnd + MAX_PREFETCH_GAP && u32End - u32PieceEnd <= u32Free) {
+                for (j = 0; j < iStaged; j++) {
+                    if (pBBTT->prefetch[j].offset >= u32PieceEnd && pBBTT->prefetch[j].offset < list[i].offset) {
+                        break;
+                    }
+                }
+                if (j == iStaged) {
+                    u32Free -= u32End - u32PieceEnd;
+                    pPiece->length = u32End - pPiece->offset;
+                    continue;
+                }
+            }
+        }
+        if (list[i].length > u32Free) {
+            continue;
+        }
+        pPiece = &pBBTT->prefetch[pBBTT->iPrefetchCount++];
+        pPiece->offset = list[i].offset;
+        pPiece->length = list[i].length;
+        pPiece->bufOffset = pBBTT->u32PrefetchSize - u32Free;
+        u32Free -= pPiece->length;
+    }
+    pBBTT->u32PrefetchUsed = pBBTT->u32PrefetchSize - u32Free;
+    for (i = iStaged; i < pBBTT->iPrefetchCount; i++) {
+        uint32_t u32Reads = pBBTT->ioStats.u32Reads;
+        pPiece = &pBBTT->prefetch[i];
+        if (pBBTT->u32PrefetchEnd) {
+            pBBTT->u32PrefetchSeek += (pPiece->offset > pBBTT->u32PrefetchEnd) ? pPiece->offset - pBBTT->u32PrefetchEnd : pBBTT->u32PrefetchEnd - pPiece->offset;
+        }
+        bbttSeek(pBBTT, pPiece->offset);
+        pPiece->length = bbttRead(pBBTT, &pBBTT->pPrefetchBuf[pPiece->bufOffset], (int)pPiece->length);
+        pBBTT->u32PrefetchEnd = pPiece->offset + pPiece->length;
+        pBBTT->u32PrefetchReads += pBBTT->ioStats.u32Reads - u32Reads;
+    }
+    bbttSortPrefetch(pBBTT->prefetch, pBBTT->iPrefetchCount);
+} /* bbttStageRecords() */
+
+//
+// Add the components of the staged compound glyphs in prefetchGlyphs[iFirst..iLast)
+//
+void bbttAddComponents(BBTT *pBBTT, int iFirst, int iLast)
+{
+    for (int i = iFirst; i < iLast; i++) {
+        const uint8_t *p = bbttFindPrefetch(pBBTT, pBBTT->prefetchGlyphs[i].offset, pBBTT->prefetchGlyphs[i].length);
+        if (p == NULL || TT_S16(p) >= 0) {
+            continue;
+        }
+        const uint8_t *pEnd = p + pBBTT->prefetchGlyphs[i].length;
+        uint16_t flags;
+        p += 10;
+        do {
+            if (p + 4 > pEnd) {
+                break;
+            }
+            flags = TT_U16(p);
+            bbttAddPrefetchGlyph(pBBTT, 0xffffffff, TT_U16(&p[2]), 0);
+            p += (flags & 0b00000000001) ? 8 : 6;
+            if (flags & 0b00000001000) {
+                p += 2;
+            } else if (flags & 0b00001000000) {
+                p += 4;
+            } else if (flags & 0b00010000000) {
+                p += 8;
+            }
+        } while (flags & 0b00000100000);
+    }
+} /* bbttAddComponents() */
+
+//
+// Stage the glyph records of a string (and of their components) before it's drawn
+//
+void bbttPrefetchString(BBTT *pBBTT, const wchar_t *szwString)
+{
+    int iLen, iFirst = 0, iLast;
+
+    pBBTT->iPrefetchCount = pBBTT->iPrefetchGlyphs = 0;
+    if (pBBTT->pTTF || pBBTT->pPrefetchBuf == NULL) {
+        return; // memory fonts don't need it
+    }
+    pBBTT->u32PrefetchUsed = 0;
+    pBBTT->u32PrefetchSeek = pBBTT->u32PrefetchEnd = pBBTT->u32PrefetchReads = 0;
+    pBBTT->u32DrawSeek = pBBTT->u32DrawRecordEnd = pBBTT->u32DrawRecords = 0;
+    for (int c = 0; szwString[c] != '\0'; c += iLen) {
+        iLen = 1;
+        if ((szwString[c] == ' ') || (szwString[c] == L'　')) {
+            continue;
+        }
+        uint32_t u32Code = bbttGetCode(&szwString[c], &iLen);
+        uint16_t glyphId = bbttCodeToGlyphId(pBBTT, u32Code);
+        bbttAddPrefetchGlyph(pBBTT, u32Code, glyphId, bbttIsCached(pBBTT, glyphId));
+    }
+    for (int iDepth = 0; iFirst < pBBTT->iPrefetchGlyphs && iDepth <= MAX_COMPOUND_DEPTH; iDepth++) {
+        bbttStageRecords(pBBTT, iFirst);
+        iLast = pBBTT->iPrefetchGlyphs;
+        bbttAddComponents(pBBTT, iFirst, iLast);
+        iFirst = iLast;
+    }
+} /* bbttPrefetchString() */
+
+//
+// Drop the staged records and add up what the prefetch saved
+//
+void bbttEndPrefetch(BBTT *pBBTT)
+{
+    if (pBBTT->iPrefetchCount) {
+        pBBTT->ioStats.u32PrefetchReads += pBBTT->u32PrefetchReads;
+        pBBTT->ioStats.u32PrefetchRecords += pBBTT->u32DrawRecords;
+        if (pBBTT->u32DrawRecords > pBBTT->u32PrefetchReads) { // one read per record otherwise
+            pBBTT->ioStats.u32ReadsSaved += pBBTT->u32DrawRecords - pBBTT->u32PrefetchReads;
+        }
+        if (pBBTT->u32DrawSeek > pBBTT->u32PrefetchSeek) {
+            pBBTT->ioStats.u32SeekBytesSaved += pBBTT->u32DrawSeek - pBBTT->u32PrefetchSeek;
+        }
+    }
+    pBBTT->iPrefetchCount = pBBTT->iPrefetchGlyphs = 0;
+} /* bbttEndPrefetch() */
+
+#ifdef BBTT_POSIX
+//
+// Background prefetch
+// A worker thread reads the glyph records of the next few characters of the
+// string while the current one is rasterized. The drawing thread does the
+// cmap/loca lookups (they use the file buffer) and queues the records; the
+// worker reads them through its own TTFILE, so the backend's read callback
+// must allow that from another thread (e.g. openTtfFile's pread)
+//
+void *bbttAsyncWorker(void *pArg)
+{
+    ttAsync_t *pAsync = (ttAsync_t *)pArg;
+
+    for (;;) {
+        uint32_t u32Done = pAsync->u32Done; // only this thread changes it
+        if (u32Done == __atomic_load_n(&pAsync->u32Queued, __ATOMIC_SEQ_CST)) {
+            int bStop;
+            pthread_mutex_lock(&pAsync->mutex);
+            __atomic_store_n(&pAsync->bWorkerIdle, 1, __ATOMIC_SEQ_CST);
+            while (!pAsync->bStop && u32Done == __atomic_load_n(&pAsync->u32Queued, __ATOMIC_SEQ_CST)) {
+                pthread_cond_wait(&pAsync->cond, &pAsync->mutex);
+            }
+            __atomic_store_n(&pAsync->bWorkerIdle, 0, __ATOMIC_RELAXED);
+            bStop = pAsync->bStop;
+            pthread_mutex_unlock(&pAsync->mutex);
+            if (bStop) {
+                break;
+            }
+            continue;
+        }
+        int iSlot = u32Done % pAsync->iSlots;
+        if (pAsync->bRead[iSlot]) {
+            (*pAsync->pfnSeek)(&pAsync->file, (int32_t)pAsync->glyphs[iSlot].offset);
+            pAsync->iRead[iSlot] = (*pAsync->pfnRead)(&pAsync->file, &pAsync->pBuffer[iSlot * pAsync->u32SlotSize], (int32_t)pAsync->glyphs[iSlot].length);
+        }
+        __atomic_store_n(&pAsync->u32Done, u32Done + 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&pAsync->bDrawWaiting, __ATOMIC_SEQ_CST)) {
+            pthread_mutex_lock(&pAsync->mutex);
+            pthread_cond_broadcast(&pAsync->cond);
+            pthread_mutex_unlock(&pAsync->mutex);
+        }
+    }
+    return NULL;
+} /* bbttAsyncWorker() */
+
+void bbttAsyncStop(BBTT *pBBTT)
+{
+    ttAsync_t *pAsync = &pBBTT->async;
+
+    if (!pAsync->bRunning) {
+        return;
+    }
+    pthread_mutex_lock(&pAsync->mutex);
+    pAsync->bStop = 1;
+    pthread_cond_broadcast(&pAsync->cond);
+    pthread_mutex_unlock(&pAsync->mutex);
+    pthread_join(pAsync->thread, NULL);
+    pthread_cond_destroy(&pAsync->cond);
+    pthread_mutex_destroy(&pAsync->mutex);
+    pAsync->bRunning = 0;
+    pAsync->pString = NULL;
+    pBBTT->asyncGlyph.code = 0xffffffff;
+    pBBTT->pAsyncData = NULL;
+} /* bbttAsyncStop() */
+
+/* start the worker for the current file font */
+int bbttAsyncStart(BBTT *pBBTT)
+{
+    ttAsync_t *pAsync = &pBBTT->async;
+
+    if (pAsync->bRunning || pAsync->pBuffer == NULL || pBBTT->pTTF || pBBTT->pfnRead == NULL) {
+        return pAsync->bRunning;
+    }
+    if (pBBTT->ttFile.fHandle == &pBBTT->ttz) {
+        return 0; // the block cache can't be shared with another thread
+    }
+    pAsync->file = pBBTT->ttFile;
+    pAsync->pfnRead = pBBTT->pfnRead;
+    pAsync->pfnSeek = pBBTT->pfnSeek;
+    pAsync->u32Queued = pAsync->u32Done = pAsync->u32Used = 0;
+    pAsync->bStop = 0;
+    pAsync->bWorkerIdle = pAsync->bDrawWaiting = 0;
+    pAsync->pString = NULL;
+    pthread_mutex_init(&pAsync->mutex, NULL);
+    pthread_cond_init(&pAsync->cond, NULL);
+    if (pthread_create(&pAsync->thread, NULL, bbttAsyncWorker, pAsync) != 0) {
+        pthread_cond_destroy(&pAsync->cond);
+        pthread_mutex_destroy(&pAsync->mutex);
+        return 0;
+    }
+    pAsync->bRunning = 1;
+    return 1;
+} /* bbttAsyncStart() */
+
+//
+// Read glyph records up to iLookahead characters ahead on a worker thread.
+// pBuffer is split into iLookahead + 1 slots; larger records are read as usual.
+// The worker starts with the next string drawn from a file font and stops when
+// the font is closed. NULL turns it off
+//
+uint8_t bbttSetAsyncPrefetch(BBTT *pBBTT, uint8_t *pBuffer, uint32_t u32Size, int iLookahead)
+{
+    ttAsync_t *pAsync = &pBBTT->async;
+
+    bbttAsyncStop(pBBTT);
+    pAsync->pBuffer = NULL;
+    if (pBuffer == NULL) {
+        return 1;
+    }
+    // one slot for the glyph being drawn and one for each glyph ahead of it
+    if (iLookahead < 1 || iLookahead >= MAX_ASYNC_GLYPHS || u32Size / (iLookahead + 1) < 10) {
+        pBBTT->lastError = BBTT_INVALID_PARAMETER;
+        return 0;
+    }
+    pAsync->pBuffer = pBuffer;
+    pAsync->iSlots = iLookahead + 1;
+    pAsync->u32SlotSize = u32Size / pAsync->iSlots;
+    return 1;
+} /* bbttSetAsyncPrefetch() */
+
+//
+// Queue the next characters of the string until the ring is full. Glyphs that
+// are cached, staged or too big for a slot are only queued for their glyph id
+//
+void bbttAsyncQueue(BBTT *pBBTT)
+{
+    ttAsync_t *pAsync = &pBBTT->async;
+    int iLen;
+
+    // a slot is free once the drawing thread is done with it and the worker has passed it
+    while (pAsync->u32Queued - pAsync->u32Used < (uint32_t)pAsync->iSlots && pAsync->u32Queued - __atomic_load_n(&pAsync->u32Done, __ATOMIC_ACQUIRE) < (uint32_t)pAsync->iSlots && pAsync->pString[pAsync->iNext] != '\0') {
+        const wchar_t *pChar = &pAsync->pString[pAsync->iNext];
+        if ((*pChar == ' ') || (*pChar == L'　')) {
+            pAsync->iNext++;
+            continue;
+        }
+        int iSlot = pAsync->u32Queued % pAsync->iSlots;
+        ttPrefetchGlyph_t *pGlyph = &pAsync->glyphs[iSlot];
+        pGlyph->code = bbttGetCode(pChar, &iLen);
+        pAsync->iNext += iLen;
+        pGlyph->glyphId = bbttCodeToGlyphId(pBBTT, pGlyph->code);
+        pGlyph->offset = pGlyph->length = 0;
+        pAsync->bRead[iSlot] = 0;
+        if (!bbttIsCached(pBBTT, pGlyph->glyphId)) {
+            pGlyph->offset = bbttGetGlyphOffset(pBBTT, pGlyph->glyphId, &pGlyph->length);
+            if (pGlyph->length >= 10 && pGlyph->length <= pAsync->u32SlotSize && !bbttFindPrefetch(pBBTT, pGlyph->offset, pGlyph->length)) {
+                pAsync->bRead[iSlot] = 1; // for the worker
+            }
+        }
+        __atomic_store_n(&pAsync->u32Queued, pAsync->u32Queued + 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&pAsync->bWorkerIdle, __ATOMIC_SEQ_CST)) {
+            pthread_mutex_lock(&pAsync->mutex);
+            pthread_cond_broadcast(&pAsync->cond);
+            pthread_mutex_unlock(&pAsync->mutex);
         }
-        int16_t iStartPoint = -1; // start of each horizontal line segment
-        for (int16_t x = xs; x < xe; x++) {
-            int16_t windingNumber = 0;
-            point.x = x;
+    }
+} /* bbttAsyncQueue() */
 
-            for (uint16_t i = 0; i < intersectPointsNum; i++) {
-                p1 = pointsToFill[i].p1;
-                p2 = pointsToFill[i].p2;
+void bbttAsyncBegin(BBTT *pBBTT, const wchar_t *szwString)
+{
+    if (!bbttAsyncStart(pBBTT)) {
+        return;
+    }
+    pBBTT->async.pString = szwString;
+    pBBTT->async.iNext = 0;
+    bbttAsyncQueue(pBBTT);
+} /* bbttAsyncBegin() */
 
-                if (pointsToFill[i].up == 1) {
-                    if (bbttIsLeft(p1, p2, &point) > 0) {
-                        windingNumber++;
-                    }
-                } else {
-                    if (bbttIsLeft(p1, p2, &point) < 0) {
-                        windingNumber--;
-                    }
-                }
-            }
+//
+// Called by bbttTextDraw for each character it draws (in the order they were
+// queued). Finishes with the previous glyph, tops up the queue and waits (if
+// needed) for the worker to finish reading this one
+//
+void bbttAsyncNext(BBTT *pBBTT, uint32_t _code)
+{
+    ttAsync_t *pAsync = &pBBTT->async;
 
-            if (windingNumber != 0) {
-              //  addPixel(x, y, colorInside);
-                if (iStartPoint == -1) {
-                    iStartPoint = x; // start of a new line?
-                }
-            } else { // finishing a line segment?
-                if (iStartPoint >= 0) {
-                    if (pBBTT->pfnDrawLine) {
-                        (*pBBTT->pfnDrawLine)(iStartPoint, y, x-1, y, pBBTT->colorInside);
-                    } else {
-                        bbttDrawLine(pBBTT, iStartPoint, y, x-1, y, pBBTT->colorInside);
-                    }
-                    iStartPoint = -1; // reset for next time
-                }
-            }
-        } // for x
-        if (iStartPoint >= 0) {
-            if (pBBTT->pfnDrawLine) {
-                (*pBBTT->pfnDrawLine)(iStartPoint, y, xe-1, y, pBBTT->colorInside);
-            } else {
-                bbttDrawLine(pBBTT, iStartPoint, y, xe-1, y, pBBTT->colorInside);
+    if (pAsync->pString == NULL) {
+        return;
+    }
+    if (pBBTT->asyncGlyph.code != 0xffffffff) {
+        pBBTT->asyncGlyph.code = 0xffffffff;
+        pBBTT->pAsyncData = NULL;
+        pAsync->u32Used++; // its slot can be reused
+    }
+    bbttAsyncQueue(pBBTT);
+    if (pAsync->u32Used == pAsync->u32Queued) {
+        return;
+    }
+    int iSlot = pAsync->u32Used % pAsync->iSlots;
+    if (pAsync->glyphs[iSlot].code != _code) {
+        return; // out of step (a repeated character); read it as usual
+    }
+    if (pAsync->bRead[iSlot]) {
+        if ((int32_t)(__atomic_load_n(&pAsync->u32Done, __ATOMIC_ACQUIRE) - pAsync->u32Used) <= 0) {
+            pBBTT->ioStats.u32AsyncWaits++;
+            pthread_mutex_lock(&pAsync->mutex);
+            __atomic_store_n(&pAsync->bDrawWaiting, 1, __ATOMIC_SEQ_CST);
+            while ((int32_t)(__atomic_load_n(&pAsync->u32Done, __ATOMIC_SEQ_CST) - pAsync->u32Used) <= 0) {
+                pthread_cond_wait(&pAsync->cond, &pAsync->mutex);
             }
+            __atomic_store_n(&pAsync->bDrawWaiting, 0, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&pAsync->mutex);
+        }
+        if ((uint32_t)pAsync->iRead[iSlot] == pAsync->glyphs[iSlot].length) {
+            pBBTT->pAsyncData = &pAsync->pBuffer[iSlot * pAsync->u32SlotSize];
+            pBBTT->ioStats.u32AsyncRecords++;
         }
     }
-}
+    pBBTT->asyncGlyph = pAsync->glyphs[iSlot];
+} /* bbttAsyncNext() */
+
+//
+// Let the worker finish what's queued (the slots are reused) and drop it
+//
+void bbttAsyncEnd(BBTT *pBBTT)
+{
+    ttAsync_t *pAsync = &pBBTT->async;
+
+    if (pAsync->pString == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&pAsync->mutex);
+    __atomic_store_n(&pAsync->bDrawWaiting, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&pAsync->u32Done, __ATOMIC_SEQ_CST) != pAsync->u32Queued) {
+        pthread_cond_wait(&pAsync->cond, &pAsync->mutex);
+    }
+    __atomic_store_n(&pAsync->bDrawWaiting, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&pAsync->mutex);
+    pAsync->u32Used = pAsync->u32Queued;
+    pAsync->pString = NULL;
+    pBBTT->asyncGlyph.code = 0xffffffff;
+    pBBTT->pAsyncData = NULL;
+} /* bbttAsyncEnd() */
+#endif // BBTT_POSIX
 
 void bbttTextDraw(BBTT *pBBTT, int16_t _x, int16_t _y, const wchar_t _character[]) {
-    uint8_t c = 0;
+    uint16_t c = 0;
+    int iLen;
     uint16_t prev_code = 0;
 
+    if (!bbttFontReady(pBBTT)) {
+        return;
+    }
+    bbttPrefetchString(pBBTT, _character);
+#ifdef BBTT_POSIX
+    bbttAsyncBegin(pBBTT, _character);
+#endif
     if (pBBTT->textAlign != TEXT_ALIGN_LEFT) {
         // need to get the width of the curernt line to center it or align right
         int cx = bbttGetStringWidthW(pBBTT, _character);
@@ -917,10 +3443,21 @@ void bbttTextDraw(BBTT *pBBTT, int16_t _x, int16_t _y, const wchar_t _character[
             continue;
         }
 
-        pBBTT->charCode = bbttCodeToGlyphId(pBBTT, _character[c]);
-
-        //Serial.printf("code:%4d\n", charCode);
-        bbttReadGlyph(pBBTT, pBBTT->charCode, 0);
+        uint32_t u32Code = bbttGetCode(&_character[c], &iLen);
+#ifdef BBTT_POSIX
+        bbttAsyncNext(pBBTT, u32Code); // take the record the worker read
+#endif
+        uint16_t glyphId = pBBTT->charCode = bbttCodeToGlyphId(pBBTT, u32Code);
+        ttBitmapCacheEntry_t *pBitmap = NULL;
+        if (bbttUseBitmapCache(pBBTT)) {
+            pBitmap = bbttFindCachedBitmap(pBBTT, glyphId);
+        }
+        if (pBitmap) { // no need to decode the outline
+            pBBTT->charCode = pBitmap->metricsId;
+        } else {
+            //Serial.printf("code:%4d\n", charCode);
+            bbttReadGlyph(pBBTT, pBBTT->charCode, 0);
+        }
 
         _x += pBBTT->characterSpace;
 #ifdef ENABLEKERNING
@@ -954,13 +3491,39 @@ void bbttTextDraw(BBTT *pBBTT, int16_t _x, int16_t _y, const wchar_t _character[
             continue;
         }
 
-        if (pBBTT->glyph.numberOfContours >= 0) {
-            bbttGenerateOutline(pBBTT, _x, _y, pBBTT->characterSize);
-            if (pBBTT->colorInside != COLOR_NONE) {
-                bbttFillGlyph(pBBTT, _x, _y, pBBTT->characterSize);
+        if (pBBTT->glyph.numberOfContours >= 0 && !pBitmap && bbttUseBitmapCache(pBBTT)) {
+            pBitmap = bbttRenderCachedBitmap(pBBTT, glyphId);
+        }
+        // where the glyph goes in the framebuffer
+        int16_t x = _x, y = _y;
+        int32_t ox = 0, oy = 0;
+        if (pBBTT->transformType != TRANSFORM_NONE) {
+            bbttTransformOrigin(pBBTT, _x, _y, &ox, &oy);
+            x = (int16_t)(ox >> 16);
+            y = (int16_t)(oy >> 16);
+        }
+        if (pBitmap) {
+            bbttDrawCachedBitmap(pBBTT, pBitmap, x, y);
+        } else if (pBBTT->glyph.numberOfContours >= 0) {
+            if (pBBTT->antialias != TEXT_AA_NONE && pBBTT->colorInside != COLOR_NONE) {
+                bbttGenerateOutline(pBBTT, 0, 0, pBBTT->characterSize << AA_SHIFT);
+                if (pBBTT->transformType != TRANSFORM_NONE) {
+                    bbttTransformOutline(pBBTT, ox, oy, AA_SHIFT, 1);
+                }
+                bbttFillGlyphAA(pBBTT, x, y);
+            } else if (pBBTT->transformType != TRANSFORM_NONE) {
+                bbttGenerateTransformed(pBBTT, ox, oy);
+                if (pBBTT->colorInside != COLOR_NONE) {
+                    bbttFillGlyph(pBBTT, x, y, pBBTT->characterSize);
+                }
+            } else {
+                bbttGenerateOutline(pBBTT, _x, _y, pBBTT->characterSize);
+                if (pBBTT->colorInside != COLOR_NONE) {
+                    bbttFillGlyph(pBBTT, _x, _y, pBBTT->characterSize);
+                }
             }
             if (pBBTT->colorLine != COLOR_NONE && pBBTT->colorLine != pBBTT->colorInside) {
-                bbttDrawOutline(pBBTT, _x, _y, pBBTT->characterSize);
+                bbttDrawOutline(pBBTT, x, y, pBBTT->characterSize);
             }
         }
         pBBTT->numPoints = pBBTT->numBeginPoints = pBBTT->numEndPoints = 0; // reset for next pass
@@ -968,42 +3531,44 @@ void bbttTextDraw(BBTT *pBBTT, int16_t _x, int16_t _y, const wchar_t _character[
         pBBTT->glyph.numberOfContours = 0;
 
         _x += hMetric.advanceWidth;
-        c++;
+        c += iLen;
     }
+#ifdef BBTT_POSIX
+    bbttAsyncEnd(pBBTT);
+#endif
+    bbttEndPrefetch(pBBTT);
 } /* bbttTextDraw() */
 
 /* read table directory */
-int bbttReadTableDirectory(BBTT *pBBTT, int checkCheckSum) {
+int bbttReadTableDirectory(BBTT *pBBTT) {
     bbttSeek(pBBTT, numTablesPos);
     pBBTT->numTables = bbttGetUInt16t(pBBTT);
+    if (pBBTT->numTables > MAX_TABLES) {
+        pBBTT->numTables = MAX_TABLES;
+    }
     bbttSeek(pBBTT, tablePos);
     for (int i = 0; i < pBBTT->numTables; i++) {
         for (int j = 0; j < 4; j++) {
             pBBTT->table[i].name[j] = bbttGetUInt8t(pBBTT);
         }
         pBBTT->table[i].name[4] = '\0';
+        pBBTT->table[i].tag = TT_TAG(pBBTT->table[i].name[0], pBBTT->table[i].name[1], pBBTT->table[i].name[2], pBBTT->table[i].name[3]);
         pBBTT->table[i].checkSum = bbttGetUInt32t(pBBTT);
         pBBTT->table[i].offset = bbttGetUInt32t(pBBTT);
         pBBTT->table[i].length = bbttGetUInt32t(pBBTT);
     }
-
-    if (checkCheckSum) {
-        for (int i = 0; i < pBBTT->numTables; i++) {
-            if (strcmp(pBBTT->table[i].name, "head") != 0) { /* checksum of "head" is invalid */
-                uint32_t c = bbttCalculateCheckSum(pBBTT, pBBTT->table[i].offset, pBBTT->table[i].length);
-                if (pBBTT->table[i].checkSum != c) {
-                    return 0;
-                }
-            }
-        }
-    }
-    return 1;
+    // the glyph lookups need these on every character
+    int iTable = bbttFindTable(pBBTT, TT_TAG('l','o','c','a'));
+    pBBTT->locaTablePos = (iTable < 0) ? 0 : pBBTT->table[iTable].offset;
+    iTable = bbttFindTable(pBBTT, TT_TAG('g','l','y','f'));
+    pBBTT->glyfTablePos = (iTable < 0) ? 0 : pBBTT->table[iTable].offset;
+    return (pBBTT->numTables != 0);
 }
 
 /* read head table */
 void bbttReadHeadTable(BBTT *pBBTT) {
     for (int i = 0; i < pBBTT->numTables; i++) {
-        if (strcmp(pBBTT->table[i].name, "head") == 0) {
+        if (pBBTT->table[i].tag == TT_TAG('h','e','a','d')) {
             bbttSeek(pBBTT, pBBTT->table[i].offset);
 
             pBBTT->headTable.version = bbttGetUInt32t(pBBTT);
@@ -1013,10 +3578,10 @@ void bbttReadHeadTable(BBTT *pBBTT) {
             pBBTT->headTable.flags = bbttGetUInt16t(pBBTT);
             pBBTT->headTable.unitsPerEm = bbttGetUInt16t(pBBTT);
             for (int j = 0; j < 8; j++) {
-                pBBTT->headTable.created[i] = bbttGetUInt8t(pBBTT);
+                pBBTT->headTable.created[j] = bbttGetUInt8t(pBBTT);
             }
             for (int j = 0; j < 8; j++) {
-                pBBTT->headTable.modified[i] = bbttGetUInt8t(pBBTT);
+                pBBTT->headTable.modified[j] = bbttGetUInt8t(pBBTT);
             }
             pBBTT->xMin = pBBTT->headTable.xMin = bbttGetInt16t(pBBTT);
             pBBTT->yMin = pBBTT->headTable.yMin = bbttGetInt16t(pBBTT);
@@ -1032,6 +3597,8 @@ void bbttReadHeadTable(BBTT *pBBTT) {
 }
 /* read cmap format 4 */
 uint8_t bbttReadCmapFormat4(BBTT *pBBTT) {
+    uint16_t segCount, searchRange = 1, entrySelector = 0;
+
     bbttSeek(pBBTT, pBBTT->cmapFormat4.offset);
     if ((pBBTT->cmapFormat4.format = bbttGetUInt16t(pBBTT)) != 4) {
         return 0;
@@ -1040,9 +3607,19 @@ uint8_t bbttReadCmapFormat4(BBTT *pBBTT) {
     pBBTT->cmapFormat4.length = bbttGetUInt16t(pBBTT);
     pBBTT->cmapFormat4.language = bbttGetUInt16t(pBBTT);
     pBBTT->cmapFormat4.segCountX2 = bbttGetUInt16t(pBBTT);
+    segCount = pBBTT->cmapFormat4.segCountX2 / 2;
     pBBTT->cmapFormat4.searchRange = bbttGetUInt16t(pBBTT);
     pBBTT->cmapFormat4.entrySelector = bbttGetUInt16t(pBBTT);
     pBBTT->cmapFormat4.rangeShift = bbttGetUInt16t(pBBTT);
+    // derive these from segCountX2 so that a bad font can't lead the binary
+    // search in bbttCodeToGlyphId() outside of the table
+    while (segCount && searchRange * 2 <= segCount) {
+        searchRange *= 2;
+        entrySelector++;
+    }
+    pBBTT->cmapFormat4.searchRange = searchRange * 2;
+    pBBTT->cmapFormat4.entrySelector = entrySelector;
+    pBBTT->cmapFormat4.rangeShift = pBBTT->cmapFormat4.segCountX2 - searchRange * 2;
     pBBTT->cmapFormat4.endCodeOffset = pBBTT->cmapFormat4.offset + 14;
     pBBTT->cmapFormat4.startCodeOffset = pBBTT->cmapFormat4.endCodeOffset + pBBTT->cmapFormat4.segCountX2 + 2;
     pBBTT->cmapFormat4.idDeltaOffset = pBBTT->cmapFormat4.startCodeOffset + pBBTT->cmapFormat4.segCountX2;
@@ -1051,12 +3628,36 @@ uint8_t bbttReadCmapFormat4(BBTT *pBBTT) {
 
     return 1;
 }
+/* read cmap format 12 */
+uint8_t bbttReadCmapFormat12(BBTT *pBBTT) {
+    uint32_t length, numGroups;
+
+    bbttSeek(pBBTT, pBBTT->cmapFormat12.offset);
+    if (bbttGetUInt16t(pBBTT) != 12) {
+        return 0;
+    }
+    bbttGetUInt16t(pBBTT); // reserved
+    length = bbttGetUInt32t(pBBTT);
+    bbttGetUInt32t(pBBTT); // language
+    numGroups = bbttGetUInt32t(pBBTT);
+    // don't let a bad count send the binary search past the end of the subtable
+    if (length < 16 || numGroups > (length - 16) / 12) {
+        return 0;
+    }
+    pBBTT->cmapFormat12.numGroups = numGroups;
+    pBBTT->cmapFormat12.groupsOffset = pBBTT->cmapFormat12.offset + 16;
+
+    return 1;
+} /* bbttReadCmapFormat12() */
 /* read cmap */
 uint8_t bbttReadCmap(BBTT *pBBTT) {
     uint16_t platformId, platformSpecificId;
     uint32_t cmapOffset, tableOffset;
+    uint32_t format4Offset = 0, format12Offset = 0;
     uint8_t foundMap = 0;
 
+    pBBTT->cmapFormat4.segCountX2 = 0;
+    pBBTT->cmapFormat12.numGroups = 0;
     if ((cmapOffset = bbttSeekToTable(pBBTT, "cmap")) == 0) {
         return 0;
     }
@@ -1064,15 +3665,33 @@ uint8_t bbttReadCmap(BBTT *pBBTT) {
     pBBTT->cmapIndex.version = bbttGetUInt16t(pBBTT);
     pBBTT->cmapIndex.numberSubtables = bbttGetUInt16t(pBBTT);
 
+    // Windows BMP (3/1) is format 4; Windows full repertoire (3/10) and
+    // Unicode full repertoire (0/4) are format 12
     for (uint16_t i = 0; i < pBBTT->cmapIndex.numberSubtables; i++) {
         platformId = bbttGetUInt16t(pBBTT);
         platformSpecificId = bbttGetUInt16t(pBBTT);
         tableOffset = bbttGetUInt32t(pBBTT);
-        if ((platformId == 3) && (platformSpecificId == 1)) {
-            pBBTT->cmapFormat4.offset = cmapOffset + tableOffset;
-            bbttReadCmapFormat4(pBBTT);
+        if ((platformId == 3) && (platformSpecificId == 1) && format4Offset == 0) {
+            format4Offset = cmapOffset + tableOffset;
+        } else if (((platformId == 3) && (platformSpecificId == 10)) || ((platformId == 0) && (platformSpecificId == 4))) {
+            if (format12Offset == 0) {
+                format12Offset = cmapOffset + tableOffset;
+            }
+        }
+    }
+
+    if (format4Offset) {
+        pBBTT->cmapFormat4.offset = format4Offset;
+        if (bbttReadCmapFormat4(pBBTT)) {
+            foundMap = 1;
+        } else {
+            pBBTT->cmapFormat4.segCountX2 = 0;
+        }
+    }
+    if (format12Offset) {
+        pBBTT->cmapFormat12.offset = format12Offset;
+        if (bbttReadCmapFormat12(pBBTT)) {
             foundMap = 1;
-            break;
         }
     }
 
@@ -1083,44 +3702,262 @@ uint8_t bbttReadCmap(BBTT *pBBTT) {
     return 1;
 } /* bbttReadCmap() */
 
-uint8_t bbttSetTtfPointer(BBTT *pBBTT, uint8_t *p, uint32_t u32Size, uint8_t _checkCheckSum) {
-    pBBTT->pTTF = p;
-    pBBTT->u32TTFSize = u32Size;
+//
+// Copy u32Len bytes of the font at u32Offset to the next 4-byte aligned spot of
+// the index buffer. Returns NULL (and uses nothing) if it doesn't fit
+//
+uint8_t *bbttPreloadTable(BBTT *pBBTT, uint32_t u32Offset, uint32_t u32Len)
+{
+    uint32_t u32Start = pBBTT->u32IndexUsed + ((0 - (uintptr_t)&pBBTT->pIndexBuf[pBBTT->u32IndexUsed]) & 3);
+    uint8_t *p;
 
-   // printf("BBTT size = %d\n", sizeof(BBTT));
-    if (bbttReadTableDirectory(pBBTT, _checkCheckSum) == 0) {
-#ifdef ESP32
-        pBBTT->file.close();
+    if (u32Len == 0 || u32Start > pBBTT->u32IndexSize || u32Len > pBBTT->u32IndexSize - u32Start) {
+        return NULL;
+    }
+    p = &pBBTT->pIndexBuf[u32Start];
+    memset(p, 0, u32Len);
+    bbttSeek(pBBTT, u32Offset);
+    bbttRead(pBBTT, p, (int)u32Len);
+    pBBTT->u32IndexUsed = u32Start + u32Len;
+    return p;
+} /* bbttPreloadTable() */
+
+/* convert u32Count big-endian values in place to native order */
+void bbttSwap16(uint8_t *p, uint32_t u32Count)
+{
+    for (uint32_t i = 0; i < u32Count; i++) {
+        ((uint16_t *)p)[i] = TT_U16(&p[i * 2]);
+    }
+} /* bbttSwap16() */
+
+void bbttSwap32(uint8_t *p, uint32_t u32Count)
+{
+    for (uint32_t i = 0; i < u32Count; i++) {
+        ((uint32_t *)p)[i] = TT_U32(&p[i * 4]);
+    }
+} /* bbttSwap32() */
+
+//
+// Load the tables used by every character into the index buffer. They go in
+// order of the reads they save: the cmap (a binary search), then loca and hmtx.
+// A table that doesn't fit in what's left is skipped and read from the font
+//
+void bbttPreloadIndex(BBTT *pBBTT)
+{
+    uint8_t *p;
+    uint32_t u32Len;
+    int iTable;
+
+    bbttClearIndex(pBBTT);
+    if (pBBTT->pIndexBuf == NULL) {
+        return;
+    }
+    if (pBBTT->cmapFormat12.numGroups) {
+        p = bbttPreloadTable(pBBTT, pBBTT->cmapFormat12.groupsOffset, pBBTT->cmapFormat12.numGroups * 12);
+        if (p) {
+            bbttSwap32(p, pBBTT->cmapFormat12.numGroups * 3);
+            pBBTT->pCmap12 = (uint32_t *)p;
+            pBBTT->u8IndexTables |= TT_INDEX_CMAP;
+        }
+    } else if (pBBTT->cmapFormat4.segCountX2) {
+        // the segment arrays and glyphIdArray run to the end of the subtable;
+        // without room for the glyphIdArray, just the segment arrays
+        uint32_t u32Segments = pBBTT->cmapFormat4.glyphIndexArrayOffset - pBBTT->cmapFormat4.endCodeOffset;
+        u32Len = pBBTT->cmapFormat4.offset + pBBTT->cmapFormat4.length - pBBTT->cmapFormat4.endCodeOffset;
+        if (u32Len < u32Segments) {
+            u32Len = u32Segments;
+        }
+        p = bbttPreloadTable(pBBTT, pBBTT->cmapFormat4.endCodeOffset, u32Len & ~1);
+        if (p == NULL) {
+            p = bbttPreloadTable(pBBTT, pBBTT->cmapFormat4.endCodeOffset, u32Len = u32Segments);
+        }
+        if (p) {
+            pBBTT->u32Cmap4Words = u32Len / 2;
+            bbttSwap16(p, pBBTT->u32Cmap4Words);
+            pBBTT->pCmap4 = (uint16_t *)p;
+            pBBTT->u8IndexTables |= TT_INDEX_CMAP;
+        }
+    }
+    iTable = bbttFindTable(pBBTT, TT_TAG('l','o','c','a'));
+    if (iTable >= 0) {
+        int iShift = (pBBTT->headTable.indexToLocFormat == 1) ? 2 : 1;
+        uint32_t u32Count = pBBTT->table[iTable].length >> iShift;
+        p = bbttPreloadTable(pBBTT, pBBTT->locaTablePos, u32Count << iShift);
+        if (p) {
+            if (iShift == 2) {
+                bbttSwap32(p, u32Count);
+                pBBTT->pLocaLong = (uint32_t *)p;
+            } else {
+                bbttSwap16(p, u32Count);
+                pBBTT->pLocaShort = (uint16_t *)p;
+            }
+            pBBTT->u32LocaCount = u32Count;
+            pBBTT->u8IndexTables |= TT_INDEX_LOCA;
+        }
+    }
+    iTable = bbttFindTable(pBBTT, TT_TAG('h','m','t','x'));
+    u32Len = pBBTT->numOfLongHorMetrics * 4;
+    if (iTable >= 0 && u32Len <= pBBTT->table[iTable].length) {
+        p = bbttPreloadTable(pBBTT, pBBTT->hmtxTablePos, u32Len);
+        if (p) {
+            // advanceWidth, leftSideBearing pairs are the layout of ttHMetric_t
+            bbttSwap16(p, pBBTT->numOfLongHorMetrics * 2);
+            pBBTT->pHMetrics = (ttHMetric_t *)p;
+            pBBTT->u8IndexTables |= TT_INDEX_HMTX;
+        }
+    }
+} /* bbttPreloadIndex() */
+
+//
+// Give the library memory to hold the cmap, loca and hmtx data of the font in
+// native byte order; saves several file reads per character. Set it before the
+// font (or it's loaded right away if a font is already set); NULL turns it off
+//
+void bbttSetIndexBuffer(BBTT *pBBTT, uint8_t *pBuffer, uint32_t u32Size)
+{
+    pBBTT->pIndexBuf = (u32Size) ? pBuffer : NULL;
+    pBBTT->u32IndexSize = (pBuffer) ? u32Size : 0;
+    if (pBBTT->cmapFormat4.segCountX2 || pBBTT->cmapFormat12.numGroups) { // a font is already loaded
+        bbttPreloadIndex(pBBTT);
+        bbttFillGlyphTable(pBBTT);
+    } else {
+        bbttClearIndex(pBBTT);
+    }
+} /* bbttSetIndexBuffer() */
+
+//
+// Close the current font backend (if any)
+//
+void bbttCloseFile(BBTT *pBBTT)
+{
+#ifdef BBTT_POSIX
+    bbttAsyncStop(pBBTT); // before its backend goes away
 #endif
+    if (pBBTT->pfnClose) {
+        (*pBBTT->pfnClose)(&pBBTT->ttFile);
+    }
+    if (pBBTT->ttFile.pData && pBBTT->pTTF == pBBTT->ttFile.pData) { // mapping is gone
+        pBBTT->pTTF = NULL;
+    }
+    memset(&pBBTT->ttFile, 0, sizeof(TTFILE));
+    pBBTT->pfnRead = NULL;
+    pBBTT->pfnSeek = NULL;
+    pBBTT->pfnClose = NULL;
+    bbttClearPages(pBBTT);
+    pBBTT->u32FilePos = 0;
+} /* bbttCloseFile() */
+
+//
+// Check the checksums (if asked to) and read the tables needed to draw text
+//
+uint8_t bbttLoadTables(BBTT *pBBTT)
+{
+    pBBTT->bTablesPending = 0;
+    if (pBBTT->bCheckSum && bbttCheckFont(pBBTT, 0) != TT_CHECK_OK) {
+        bbttCloseFile(pBBTT);
         return 0;
     }
 
     if (bbttReadCmap(pBBTT) == 0) {
-#ifdef ESP32
-        pBBTT->file.close();
-#endif
+        bbttCloseFile(pBBTT);
         return 0;
     }
 
     if (bbttReadHMetric(pBBTT) == 0) {
-#ifdef ESP32
-        pBBTT->file.close();
-#endif
+        bbttCloseFile(pBBTT);
         return 0;
     }
 
 #ifdef ENABLEKERNING
-    readKern();
+    bbttReadKern(pBBTT);
 #endif
     bbttReadHeadTable(pBBTT);
     bbttReadHhea(pBBTT);
+    bbttPreloadIndex(pBBTT);
+    bbttFillGlyphTable(pBBTT);
     return 1;
-}
+} /* bbttLoadTables() */
+
+//
+// Make sure a font is there to draw or measure with, reading the rest of
+// its tables first if it was opened lazily
+//
+uint8_t bbttFontReady(BBTT *pBBTT)
+{
+    if (pBBTT->bTablesPending && !bbttLoadTables(pBBTT)) {
+        return 0;
+    }
+    return (pBBTT->headTable.unitsPerEm != 0); // no font or a failed load
+} /* bbttFontReady() */
+
+//
+// Read the font's table directory and (unless it's opened lazily) the tables
+// needed to draw text; the same for every font source
+//
+uint8_t bbttLoadFont(BBTT *pBBTT, uint8_t _checkCheckSum)
+{
+    // cached outlines and bitmaps belong to the previous font
+    pBBTT->glyphCache.u32Used = pBBTT->bitmapCache.u32Used = 0;
+    bbttClearPages(pBBTT);
+    // nothing is pinned until the cmap and loca of this font are known
+    pBBTT->numTables = 0;
+    pBBTT->cmapFormat4.segCountX2 = 0;
+    pBBTT->cmapFormat12.numGroups = 0;
+    memset(&pBBTT->ioStats, 0, sizeof(ttIOStats_t));
+    bbttClearIndex(pBBTT);
+    pBBTT->bTablesPending = 0;
+    pBBTT->headTable.unitsPerEm = 0;
+
+    if (bbttReadTableDirectory(pBBTT) == 0) {
+        bbttCloseFile(pBBTT);
+        return 0;
+    }
+    pBBTT->bCheckSum = _checkCheckSum;
+    pBBTT->iCheckState = TT_CHECK_PENDING;
+    pBBTT->iCheckTable = 0;
+    pBBTT->u32CheckPos = pBBTT->u32CheckSum = 0;
+    if (pBBTT->bLazyOpen) { // the rest waits until the font is used
+        if (bbttFindTable(pBBTT, TT_TAG('c','m','a','p')) < 0) {
+            bbttCloseFile(pBBTT);
+            return 0;
+        }
+        pBBTT->bTablesPending = 1;
+        return 1;
+    }
+    return bbttLoadTables(pBBTT);
+} /* bbttLoadFont() */
+
+uint8_t bbttSetTtfPointer(BBTT *pBBTT, uint8_t *p, uint32_t u32Size, uint8_t _checkCheckSum) {
+    bbttCloseFile(pBBTT);
+    pBBTT->pTTF = p;
+    pBBTT->u32TTFSize = u32Size;
+    pBBTT->u32TTFOffset = 0;
+    return bbttLoadFont(pBBTT, _checkCheckSum);
+} /* bbttSetTtfPointer() */
+
+//
+// Use a custom font source; reads go through pfnRead/pfnSeek and the file
+// buffer (see bbttSetFileBuffer). pfnClose (optional) is called when the font is replaced or ended
+//
+uint8_t bbttSetTtfCallbacks(BBTT *pBBTT, void *fHandle, int32_t iSize, TTF_READ_CALLBACK *pfnRead, TTF_SEEK_CALLBACK *pfnSeek, TTF_CLOSE_CALLBACK *pfnClose, uint8_t _checkCheckSum)
+{
+    bbttCloseFile(pBBTT);
+    if (pfnRead == NULL || pfnSeek == NULL) {
+        pBBTT->lastError = BBTT_INVALID_PARAMETER;
+        return 0;
+    }
+    pBBTT->pTTF = NULL;
+    pBBTT->ttFile.fHandle = fHandle;
+    pBBTT->ttFile.iSize = iSize;
+    pBBTT->pfnRead = pfnRead;
+    pBBTT->pfnSeek = pfnSeek;
+    pBBTT->pfnClose = pfnClose;
+    (*pfnSeek)(&pBBTT->ttFile, 0);
+    return bbttLoadFont(pBBTT, _checkCheckSum);
+} /* bbttSetTtfCallbacks() */
 
 void bbttEnd(BBTT *pBBTT) {
-#ifdef ESP32
-    pBBTT->file.close();
-#endif
+    bbttCloseFile(pBBTT);
     pBBTT->glyph.numberOfPoints = 0;
     pBBTT->glyph.numberOfContours = 0;
 }
@@ -1146,37 +3983,333 @@ void bbttSetFramebuffer(BBTT *pBBTT, uint16_t _framebufferWidth, uint16_t _frame
             pBBTT->displayWidthFrame = (pBBTT->displayWidth + 7) / 8;
             break;
     }
+    if (pBBTT->stringRotation) { // it depends on the size
+        bbttSetRotation(pBBTT, pBBTT->stringRotation);
+    } else {
+        bbttSetClip(pBBTT);
+    }
 } /* bbttSetFramebuffer() */
 
+//
+// Block compressed fonts (see setTtzPointer); the container is read as if it
+// were the font file. Only the blocks that reads touch are decompressed into
+// the block cache, so most of the font stays compressed in FLASH
+//
+uint32_t bbttTtz32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+} /* bbttTtz32() */
+
+//
+// Decompress one block. It's a series of LZ77 sequences: a token byte holds the
+// literal count (high nibble) and the match length - 4 (low nibble); 15 means
+// that more length bytes follow (255 = yet another one). The literals come
+// next, then a 2-byte offset back into the output and the extra match length
+// bytes. The last sequence has only literals.
+// Returns the number of bytes written or -1 if the data is bad
+//
+int bbttUnpackBlock(const uint8_t *s, int iSrcLen, uint8_t *d, int iDstLen)
+{
+    const uint8_t *pSrcEnd = s + iSrcLen;
+    uint8_t *pOut = d;
+    uint8_t *pOutEnd = d + iDstLen;
+    int iToken, iLen, iOffset, c;
+
+    while (s < pSrcEnd) {
+        iToken = *s++;
+        iLen = iToken >> 4;
+        if (iLen == 15) {
+            do {
+                if (s >= pSrcEnd) return -1;
+                c = *s++;
+                iLen += c;
+            } while (c == 255);
+        }
+        if (iLen > pSrcEnd - s || iLen > pOutEnd - pOut) {
+            return -1;
+        }
+        memcpy(pOut, s, iLen);
+        pOut += iLen;
+        s += iLen;
+        if (s == pSrcEnd) {
+            break; // the last sequence
+        }
+        if (pSrcEnd - s < 2) {
+            return -1;
+        }
+        iOffset = s[0] | (s[1] << 8);
+        s += 2;
+        iLen = (iToken & 15) + 4;
+        if ((iToken & 15) == 15) {
+            do {
+                if (s >= pSrcEnd) return -1;
+                c = *s++;
+                iLen += c;
+            } while (c == 255);
+        }
+        if (iOffset == 0 || iOffset > pOut - d || iLen > pOutEnd - pOut) {
+            return -1;
+        }
+        const uint8_t *pMatch = pOut - iOffset;
+        if (iOffset >= iLen) {
+            memcpy(pOut, pMatch, iLen);
+            pOut += iLen;
+        } else { // overlapping (a repeating pattern)
+            while (iLen--) {
+                *pOut++ = *pMatch++;
+            }
+        }
+    }
+    return (int)(pOut - d);
+} /* bbttUnpackBlock() */
+
+//
+// Return a pointer to the uncompressed data of a block; stored blocks are used
+// in place, the rest are decompressed into the least recently used cache slot
+//
+const uint8_t *bbttTtzBlock(ttTtz_t *pTtz, uint32_t u32Block)
+{
+    const uint8_t *pOffsets = &pTtz->pData[TTZ_HEADER_SIZE + u32Block * 4];
+    uint32_t u32Start, u32End;
+    uint32_t u32BlockSize = 1 << pTtz->u8BlockShift;
+    uint32_t u32FontSize = bbttTtz32(&pTtz->pData[4]);
+    int i, iSlot;
+
+    if (u32Block >= pTtz->u32BlockCount) {
+        return NULL;
+    }
+    u32Start = bbttTtz32(pOffsets);
+    u32End = bbttTtz32(pOffsets + 4);
+    if (u32Start > u32End || u32End > pTtz->u32DataSize) {
+        return NULL;
+    }
+    if (u32FontSize - (u32Block << pTtz->u8BlockShift) < u32BlockSize) {
+        u32BlockSize = u32FontSize - (u32Block << pTtz->u8BlockShift); // the last one
+    }
+    if (u32End - u32Start == u32BlockSize) { // stored
+        return &pTtz->pData[u32Start];
+    }
+    iSlot = pTtz->iLastSlot;
+    if (pTtz->iBlock[iSlot] != (int32_t)u32Block) {
+        iSlot = 0;
+        for (i = 0; i < pTtz->iSlots; i++) {
+            if (pTtz->iBlock[i] == (int32_t)u32Block) {
+                break;
+            }
+            if (pTtz->u32LastUse[i] < pTtz->u32LastUse[iSlot]) {
+                iSlot = i;
+            }
+        }
+        if (i < pTtz->iSlots) {
+            iSlot = i;
+            pTtz->pStats->u32BlockHits++;
+        } else {
+            uint8_t *pDest = &pTtz->pCache[iSlot << pTtz->u8BlockShift];
+            if (bbttUnpackBlock(&pTtz->pData[u32Start], (int)(u32End - u32Start), pDest, (int)u32BlockSize) != (int)u32BlockSize) {
+                pTtz->iBlock[iSlot] = -1;
+                pTtz->u32LastUse[iSlot] = 0;
+                return NULL;
+            }
+            pTtz->iBlock[iSlot] = (int32_t)u32Block;
+            pTtz->pStats->u32BlocksDecoded++;
+        }
+    } else {
+        pTtz->pStats->u32BlockHits++;
+    }
+    pTtz->u32LastUse[iSlot] = ++pTtz->u32Clock;
+    pTtz->iLastSlot = iSlot;
+    return &pTtz->pCache[iSlot << pTtz->u8BlockShift];
+} /* bbttTtzBlock() */
+
+int32_t bbttReadTtz(TTFILE *pFile, uint8_t *pBuf, int32_t iLen)
+{
+    ttTtz_t *pTtz = (ttTtz_t *)pFile->fHandle;
+    uint32_t u32Mask = (1 << pTtz->u8BlockShift) - 1;
+    int32_t iTotal = 0;
+
+    if (iLen > pFile->iSize - pFile->iPos) {
+        iLen = pFile->iSize - pFile->iPos;
+    }
+    while (iLen > 0) {
+        const uint8_t *pBlock = bbttTtzBlock(pTtz, (uint32_t)pFile->iPos >> pTtz->u8BlockShift);
+        if (pBlock == NULL) {
+            break;
+        }
+        int32_t iOffset = pFile->iPos & u32Mask;
+        int32_t iCount = (int32_t)(u32Mask + 1) - iOffset;
+        if (iCount > iLen) iCount = iLen;
+        memcpy(pBuf, &pBlock[iOffset], iCount);
+        pBuf += iCount;
+        iLen -= iCount;
+        iTotal += iCount;
+        pFile->iPos += iCount;
+    }
+    return iTotal;
+} /* bbttReadTtz() */
+
+int32_t bbttSeekTtz(TTFILE *pFile, int32_t iPosition)
+{
+    pFile->iPos = iPosition;
+    return iPosition;
+} /* bbttSeekTtz() */
+
+//
+// Draw from a block compressed font (made by tools/ttf2ttz.c) in memory/FLASH.
+// pCache holds the decompressed blocks (at least one; up to MAX_TTZ_BLOCKS are used).
+// Reads go through the file buffer like any other file font (see setFileBuffer)
+//
+uint8_t bbttSetTtzPointer(BBTT *pBBTT, const uint8_t *pData, uint32_t u32Size, uint8_t *pCache, uint32_t u32CacheSize, uint8_t _checkCheckSum)
+{
+    ttTtz_t *pTtz = &pBBTT->ttz;
+    uint32_t u32FontSize;
+    uint8_t u8Shift;
+    int i;
+
+    bbttCloseFile(pBBTT);
+    if (pData == NULL || u32Size < TTZ_HEADER_SIZE || memcmp(pData, "TTZ1", 4) != 0) {
+        pBBTT->lastError = BBTT_INVALID_FILE;
+        return 0;
+    }
+    u32FontSize = bbttTtz32(&pData[4]);
+    u8Shift = pData[8];
+    if (u8Shift < TTZ_MIN_BLOCK_SHIFT || u8Shift > TTZ_MAX_BLOCK_SHIFT || u32FontSize == 0 || u32FontSize > 0x7fffffff) {
+        pBBTT->lastError = BBTT_INVALID_FILE;
+        return 0;
+    }
+    pTtz->u32BlockCount = (u32FontSize + (1 << u8Shift) - 1) >> u8Shift;
+    if (TTZ_HEADER_SIZE + (pTtz->u32BlockCount + 1) * 4 > u32Size) {
+        pBBTT->lastError = BBTT_INVALID_FILE;
+        return 0;
+    }
+    if (pCache == NULL || u32CacheSize < ((uint32_t)1 << u8Shift)) {
+        pBBTT->lastError = BBTT_INVALID_PARAMETER;
+        return 0;
+    }
+    pTtz->pData = pData;
+    pTtz->u32DataSize = u32Size;
+    pTtz->u8BlockShift = u8Shift;
+    pTtz->pCache = pCache;
+    pTtz->iSlots = (int)(u32CacheSize >> u8Shift);
+    if (pTtz->iSlots > MAX_TTZ_BLOCKS) {
+        pTtz->iSlots = MAX_TTZ_BLOCKS;
+    }
+    for (i = 0; i < MAX_TTZ_BLOCKS; i++) {
+        pTtz->iBlock[i] = -1;
+        pTtz->u32LastUse[i] = 0;
+    }
+    pTtz->iLastSlot = 0;
+    pTtz->u32Clock = 0;
+    pTtz->pStats = &pBBTT->ioStats;
+    return bbttSetTtfCallbacks(pBBTT, pTtz, (int32_t)u32FontSize, bbttReadTtz, bbttSeekTtz, NULL, _checkCheckSum);
+} /* bbttSetTtzPointer() */
+
 #ifdef ESP32
+int32_t bbttReadESP32(TTFILE *pFile, uint8_t *pBuf, int32_t iLen)
+{
+    int32_t iBytes = ((File *)pFile->fHandle)->read(pBuf, iLen);
+    if (iBytes > 0) {
+        pFile->iPos += iBytes;
+    }
+    return iBytes;
+} /* bbttReadESP32() */
+
+int32_t bbttSeekESP32(TTFILE *pFile, int32_t iPosition)
+{
+    ((File *)pFile->fHandle)->seek(iPosition);
+    pFile->iPos = iPosition;
+    return iPosition;
+} /* bbttSeekESP32() */
+
+void bbttCloseESP32(TTFILE *pFile)
+{
+    ((File *)pFile->fHandle)->close();
+} /* bbttCloseESP32() */
+
 uint8_t bbttSetTtfFile(BBTT *pBBTT, File _file, uint8_t _checkCheckSum) {
     if (_file == 0) {
         return 0;
     }
+    bbttCloseFile(pBBTT); // before the old File object is replaced
     pBBTT->file = _file;
-    if (bbttReadTableDirectory(pBBTT, _checkCheckSum) == 0) {
-        _file.close();
+    return bbttSetTtfCallbacks(pBBTT, &pBBTT->file, (int32_t)_file.size(), bbttReadESP32, bbttSeekESP32, bbttCloseESP32, _checkCheckSum);
+} /* bbttSetTtfFile() */
+#endif // ESP32
+
+#ifdef BBTT_POSIX
+//
+// pread() based backend; the position is kept in the TTFILE so no lseek calls are needed
+//
+int32_t bbttReadPOSIX(TTFILE *pFile, uint8_t *pBuf, int32_t iLen)
+{
+    ssize_t iBytes = pread((int)(intptr_t)pFile->fHandle, pBuf, iLen, pFile->iPos);
+    if (iBytes <= 0) {
         return 0;
     }
+    pFile->iPos += (int32_t)iBytes;
+    return (int32_t)iBytes;
+} /* bbttReadPOSIX() */
 
-    if (bbttReadCmap(pBBTT) == 0) {
-        _file.close();
+int32_t bbttSeekPOSIX(TTFILE *pFile, int32_t iPosition)
+{
+    pFile->iPos = iPosition;
+    return iPosition;
+} /* bbttSeekPOSIX() */
+
+void bbttClosePOSIX(TTFILE *pFile)
+{
+    close((int)(intptr_t)pFile->fHandle);
+} /* bbttClosePOSIX() */
+
+void bbttUnmapPOSIX(TTFILE *pFile)
+{
+    munmap(pFile->pData, pFile->iSize);
+} /* bbttUnmapPOSIX() */
+
+uint8_t bbttOpenTtfFile(BBTT *pBBTT, const char *szName, uint8_t _checkCheckSum)
+{
+    struct stat st;
+    int fd = open(szName, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) close(fd);
+        pBBTT->lastError = BBTT_INVALID_FILE;
         return 0;
     }
+    return bbttSetTtfCallbacks(pBBTT, (void *)(intptr_t)fd, (int32_t)st.st_size, bbttReadPOSIX, bbttSeekPOSIX, bbttClosePOSIX, _checkCheckSum);
+} /* bbttOpenTtfFile() */
 
-    if (bbttReadHMetric(pBBTT) == 0) {
-        _file.close();
+//
+// Map the whole file into memory and draw from it as if it came from
+// setTtfPointer; pages are only loaded by the OS when touched
+//
+uint8_t bbttMapTtfFile(BBTT *pBBTT, const char *szName, uint8_t _checkCheckSum)
+{
+    struct stat st;
+    uint8_t *p;
+    int fd = open(szName, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+        if (fd >= 0) close(fd);
+        pBBTT->lastError = BBTT_INVALID_FILE;
         return 0;
     }
-    pBBTT->iBufferedBytes = 0;
-#ifdef ENABLEKERNING
-    bbttReadKern(pBBTT);
-#endif
-    bbttReadHeadTable(pBBTT);
-    bbttReadHhea(pBBTT);
+    p = (uint8_t *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping stays valid
+    if (p == (uint8_t *)MAP_FAILED) {
+        pBBTT->lastError = BBTT_INVALID_FILE;
+        return 0;
+    }
+    if (bbttSetTtfPointer(pBBTT, p, (uint32_t)st.st_size, _checkCheckSum) == 0) {
+        munmap(p, st.st_size);
+        pBBTT->pTTF = NULL;
+        return 0;
+    }
+    pBBTT->ttFile.pData = p;
+    pBBTT->ttFile.iSize = (int32_t)st.st_size;
+    pBBTT->pfnClose = bbttUnmapPOSIX;
     return 1;
-} /* bbttSetTtfFile() */
-#endif // ESP32
+} /* bbttMapTtfFile() */
+#endif // BBTT_POSIX
 
 void bbttSetCharacterSize(BBTT *pBBTT, uint16_t _characterSize) {
     pBBTT->characterSize = _characterSize;
@@ -1255,12 +4388,13 @@ int16_t bbttGetKerning(BBTT *pBBTT, uint16_t _left_glyph, uint16_t _right_glyph)
 //
 // Get the position and size of the bitmap for the given character
 //
-void bbttGetCharBox(BBTT *pBBTT, wchar_t _c, ttCharBox_t *pBox)
+void bbttGetCharBox(BBTT *pBBTT, uint32_t _c, ttCharBox_t *pBox)
 {
     ttHMetric_t hMetric;
     uint16_t code;
     
     if (!pBox) return; // silently fail when passed NULL
+    if (!bbttFontReady(pBBTT)) return;
     code = bbttCodeToGlyphId(pBBTT, _c);
     if (code == 0) return; // silently fail when passed a character not in the font
     
@@ -1269,10 +4403,10 @@ void bbttGetCharBox(BBTT *pBBTT, wchar_t _c, ttCharBox_t *pBox)
     
     pBox->xAdvance = hMetric.advanceWidth;
     pBox->xOffset = hMetric.leftSideBearing;
-    int16_t ys = round((float)(pBBTT->ascender - pBBTT->glyph.yMax) * (float)pBBTT->characterSize / (float)pBBTT->headTable.unitsPerEm);
-    int16_t ye = round((float)(pBBTT->ascender - pBBTT->glyph.yMin) * (float)pBBTT->characterSize / (float)pBBTT->headTable.unitsPerEm);
-    int16_t xs = round((float)pBBTT->glyph.xMin * (float)pBBTT->characterSize / (float)pBBTT->headTable.unitsPerEm);
-    int16_t xe = /*_x_min +*/ round((float)pBBTT->glyph.xMax * (float)pBBTT->characterSize / (float)pBBTT->headTable.unitsPerEm);
+    int16_t ys = bbttScaleRound(pBBTT, pBBTT->ascender - pBBTT->glyph.yMax, 0);
+    int16_t ye = bbttScaleRound(pBBTT, pBBTT->ascender - pBBTT->glyph.yMin, 0);
+    int16_t xs = bbttScaleRound(pBBTT, pBBTT->glyph.xMin, 0);
+    int16_t xe = bbttScaleRound(pBBTT, pBBTT->glyph.xMax, 0);
     pBox->width = (xe - xs);
     pBox->height = (ye - ys);
     pBox->yOffset = ys;
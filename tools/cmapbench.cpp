@@ -0,0 +1,159 @@
+//
+// cmapbench - compare the cost of cmap format 4 and format 12 lookups
+//
+// Copyright (c) 2024 BitBank Software, Inc.
+// MIT License (see the LICENSE file of bb_truetype)
+//
+// build: c++ -O2 -o cmapbench cmapbench.cpp
+// usage: cmapbench <font.ttf> [passes]
+//
+// The font needs both a format 4 (Windows BMP) and a format 12 (full
+// repertoire) subtable, e.g. DejaVuSans. Every BMP code that format 4 maps is
+// looked up through each format, in a shuffled order so that neither gets
+// the benefit of neighbouring codes, with the font in memory, in memory with
+// the index tables preloaded (setIndexBuffer) and read from the file through
+// the default file buffer. The two formats must return the same glyph ids.
+// The time and the backend reads per lookup are printed for each.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "../src/bb_truetype.h"
+#include "../src/bbtt.inl"
+
+static BBTT bbtt;
+static uint8_t *pFont;
+static uint32_t u32FontSize;
+static uint8_t u8Index[0x80000];
+
+static int32_t FileRead(TTFILE *pFile, uint8_t *pBuf, int32_t iLen)
+{
+    int32_t iRead = (int32_t)fread(pBuf, 1, iLen, (FILE *)pFile->fHandle);
+    pFile->iPos += iRead;
+    return iRead;
+} /* FileRead() */
+
+static int32_t FileSeek(TTFILE *pFile, int32_t iPosition)
+{
+    fseek((FILE *)pFile->fHandle, iPosition, SEEK_SET);
+    pFile->iPos = iPosition;
+    return iPosition;
+} /* FileSeek() */
+
+static void FileClose(TTFILE *pFile)
+{
+    fclose((FILE *)pFile->fHandle);
+} /* FileClose() */
+
+// 0 = memory, 1 = memory with the index preloaded, 2 = file
+static int OpenFont(int iSource, const char *szName)
+{
+    bbttInit(&bbtt);
+    if (iSource == 1) {
+        bbttSetIndexBuffer(&bbtt, u8Index, sizeof(u8Index));
+    }
+    if (iSource < 2) {
+        return bbttSetTtfPointer(&bbtt, pFont, u32FontSize, 0);
+    }
+    FILE *f = fopen(szName, "rb");
+    if (f == NULL) {
+        return 0;
+    }
+    return bbttSetTtfCallbacks(&bbtt, f, (int32_t)u32FontSize, FileRead, FileSeek, FileClose, 0);
+} /* OpenFont() */
+
+// look up every code iPasses times; returns ns per lookup
+static double TimeLookups(int iFormat, const uint32_t *pCodes, int iCount, int iPasses, uint32_t *pu32Reads, uint32_t *pu32Sum)
+{
+    uint32_t u32Reads = bbtt.ioStats.u32Reads, u32Sum = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    for (int p = 0; p < iPasses; p++) {
+        for (int i = 0; i < iCount; i++) {
+            u32Sum += (iFormat == 4) ? bbttCmap4Lookup(&bbtt, (uint16_t)pCodes[i]) : bbttCmap12Lookup(&bbtt, pCodes[i]);
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    *pu32Reads = bbtt.ioStats.u32Reads - u32Reads;
+    *pu32Sum = u32Sum;
+    return std::chrono::duration<double, std::nano>(end - start).count() / ((double)iCount * iPasses);
+} /* TimeLookups() */
+
+int main(int argc, char **argv)
+{
+    static const char *szSource[] = {"memory", "memory+index", "file"};
+    static uint32_t u32Codes[0x10000];
+    int iCount = 0, iPasses = (argc > 2) ? atoi(argv[2]) : 20;
+    uint32_t u32Seed = 12345;
+    FILE *f;
+
+    if (argc < 2 || iPasses < 1) {
+        printf("usage: cmapbench <font.ttf> [passes]\n");
+        return -1;
+    }
+    f = fopen(argv[1], "rb");
+    if (f == NULL) {
+        printf("Can't open %s\n", argv[1]);
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    u32FontSize = (uint32_t)ftell(f);
+    fseek(f, 0, SEEK_SET);
+    pFont = (uint8_t *)malloc(u32FontSize ? u32FontSize : 1);
+    if (fread(pFont, 1, u32FontSize, f) != u32FontSize) {
+        printf("Error reading %s\n", argv[1]);
+        return -1;
+    }
+    fclose(f);
+
+    if (!OpenFont(0, argv[1])) {
+        printf("%s isn't a usable font\n", argv[1]);
+        return -1;
+    }
+    if (bbtt.cmapFormat4.segCountX2 == 0 || bbtt.cmapFormat12.numGroups == 0) {
+        printf("%s needs both a format 4 and a format 12 cmap\n", argv[1]);
+        return -1;
+    }
+    for (uint32_t u32 = 0; u32 <= 0xffff; u32++) {
+        uint16_t glyphId = bbttCmap4Lookup(&bbtt, (uint16_t)u32);
+        if (glyphId == 0) {
+            continue;
+        }
+        if (bbttCmap12Lookup(&bbtt, u32) != glyphId) {
+            printf("U+%04X: format 4 glyph %d, format 12 glyph %d\n", u32, glyphId, bbttCmap12Lookup(&bbtt, u32));
+            return -1;
+        }
+        u32Codes[iCount++] = u32;
+    }
+    for (int i = iCount - 1; i > 0; i--) { // same shuffle every run
+        u32Seed = u32Seed * 1103515245 + 12345;
+        int j = (int)((u32Seed >> 8) % (uint32_t)(i + 1));
+        uint32_t u32 = u32Codes[i];
+        u32Codes[i] = u32Codes[j];
+        u32Codes[j] = u32;
+    }
+    printf("%s: %d mapped BMP codes, format 4 has %d segments, format 12 has %u groups\n", argv[1], iCount, bbtt.cmapFormat4.segCountX2 / 2, bbtt.cmapFormat12.numGroups);
+    printf("%-14s %12s %12s %14s %14s\n", "source", "fmt 4 ns", "fmt 12 ns", "fmt 4 reads", "fmt 12 reads");
+    for (int s = 0; s < 3; s++) {
+        uint32_t u32Reads4, u32Reads12, u32Sum4, u32Sum12;
+        double d4, d12;
+        int iRuns = (s == 2) ? 1 : iPasses; // a file pass is slow enough on its own
+
+        if (!OpenFont(s, argv[1])) {
+            printf("%s: can't open the font\n", szSource[s]);
+            continue;
+        }
+        TimeLookups(4, u32Codes, iCount, 1, &u32Reads4, &u32Sum4); // warm up
+        d4 = TimeLookups(4, u32Codes, iCount, iRuns, &u32Reads4, &u32Sum4);
+        TimeLookups(12, u32Codes, iCount, 1, &u32Reads12, &u32Sum12);
+        d12 = TimeLookups(12, u32Codes, iCount, iRuns, &u32Reads12, &u32Sum12);
+        if (u32Sum4 != u32Sum12) {
+            printf("%s: the formats return different glyph ids\n", szSource[s]);
+        }
+        printf("%-14s %12.1f %12.1f %14.2f %14.2f\n", szSource[s], d4, d12, (double)u32Reads4 / ((double)iCount * iRuns), (double)u32Reads12 / ((double)iCount * iRuns));
+        bbttEnd(&bbtt);
+    }
+    free(pFont);
+    return 0;
+} /* main() */
@@ -0,0 +1,255 @@
+//
+// curvecheck - check the fixed point curve stepping against exact arithmetic
+//
+// Copyright (c) 2024 BitBank Software, Inc.
+// MIT License (see the LICENSE file of bb_truetype)
+//
+// build: c++ -O2 -o curvecheck curvecheck.cpp
+// usage: curvecheck <font.ttf> [size[a] ...]
+//
+// Every quadratic curve of every glyph of the font is split into the number of
+// segments bbttCurveSteps chooses, three ways:
+//   library - bbttAddCurve (16.16 forward differences)
+//   exact   - each point evaluated as an int64 fraction and truncated toward 0
+//   float   - the float Bezier evaluation the library used to do
+// and the segment end points are compared with the exact ones, at each size
+// (default 12 33 150 150a; "a" generates the outline in the anti-aliased
+// fill's sub-pixels) and with the glyph origin at 0,0 and 7,7; "points" counts
+// both origins. Then the same curves are timed through each of them, in ns
+// per curve including bbttAddLine's bookkeeping.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <chrono>
+#include "../src/bb_truetype.h"
+#include "../src/bbtt.inl"
+
+typedef struct {
+    ttCoordinate_t p[3]; // font units, y up
+    int n;               // segments
+} tCurve;
+
+static BBTT bbtt;
+volatile int16_t i16Sink; // keeps the timed loops from being optimized away
+
+// the curves of the current glyph, walked the way bbttGenerateOutline does
+static void GlyphCurves(std::vector<tCurve> &curves)
+{
+    ttGlyph_t *pGlyph = &bbtt.glyph;
+    uint16_t j = 0;
+
+    for (uint16_t i = 0; i < pGlyph->numberOfContours; i++) {
+        uint16_t last = pGlyph->endPtsOfContours[i];
+        const ttPoint_t *pContour = &pGlyph->points[j];
+        uint16_t count, start = 0, k = 0;
+        tCurve c;
+
+        if (last >= pGlyph->numberOfPoints) {
+            break;
+        }
+        if (last < j) {
+            continue;
+        }
+        count = last - j + 1;
+        j = last + 1;
+        while (start < count && !(pContour[start].flag & FLAG_ONCURVE)) {
+            start++;
+        }
+        if (start == count) {
+            start = 0;
+        }
+        c.p[0].x = pContour[start].x;
+        c.p[0].y = pContour[start].y;
+        while (k < count) {
+            uint16_t s = (k + 1 == count) ? 0 : k + 1;
+            const ttPoint_t *pPoint = &pContour[(start + s) % count];
+            c.p[1].x = pPoint->x;
+            c.p[1].y = pPoint->y;
+            if (pPoint->flag & FLAG_ONCURVE) {
+                c.p[0] = c.p[1];
+                k++;
+                continue;
+            }
+            s = (s + 1 == count) ? 0 : s + 1;
+            pPoint = &pContour[(start + s) % count];
+            if (pPoint->flag & FLAG_ONCURVE) {
+                c.p[2].x = pPoint->x;
+                c.p[2].y = pPoint->y;
+                k += 2;
+            } else {
+                c.p[2].x = (c.p[1].x + pPoint->x) / 2;
+                c.p[2].y = (c.p[1].y + pPoint->y) / 2;
+                k++;
+            }
+            c.n = bbttCurveSteps(&bbtt, c.p);
+            curves.push_back(c);
+            c.p[0] = c.p[2];
+        }
+    }
+} /* GlyphCurves() */
+
+//
+// Each evaluator adds the curve's segments to bbtt.points through bbttAddLine
+// like the library does, so the timings include the same bookkeeping
+//
+static void CurveLibrary(const tCurve *c, int16_t _x, int16_t _y, uint16_t size, const ttScale_t *pScale)
+{
+    bbtt.numPoints = bbtt.numBeginPoints = 0;
+    bbttAddCurve(&bbtt, c->p, c->n, _x, _y, size, pScale);
+} /* CurveLibrary() */
+
+static void CurveExact(const tCurve *c, int16_t _x, int16_t _y, uint16_t size)
+{
+    int64_t n = c->n, den = n * n * bbtt.headTable.unitsPerEm;
+    int16_t q[2], prev[2];
+
+    bbtt.numPoints = bbtt.numBeginPoints = 0;
+    for (int64_t k = 0; k <= n; k++) {
+        for (int i = 0; i < 2; i++) {
+            int64_t v0 = (i) ? bbtt.ascender - c->p[0].y : c->p[0].x;
+            int64_t v1 = (i) ? bbtt.ascender - c->p[1].y : c->p[1].x;
+            int64_t v2 = (i) ? bbtt.ascender - c->p[2].y : c->p[2].x;
+            int64_t num = (v0 * (n - k) * (n - k) + 2 * v1 * k * (n - k) + v2 * k * k) * size;
+            q[i] = (int16_t)(num / den) + ((i) ? _y : _x); // truncated toward 0
+        }
+        if (k) {
+            bbttAddLine(&bbtt, prev[0], prev[1], q[0], q[1]);
+        }
+        prev[0] = q[0];
+        prev[1] = q[1];
+    }
+} /* CurveExact() */
+
+static void CurveFloat(const tCurve *c, int16_t _x, int16_t _y, uint16_t size)
+{
+    float upem = bbtt.headTable.unitsPerEm;
+    int16_t q[2], prev[2];
+
+    bbtt.numPoints = bbtt.numBeginPoints = 0;
+    for (int k = 0; k <= c->n; k++) {
+        float t = (float)k / (float)c->n;
+        float x = (1.0 - t) * (1.0 - t) * c->p[0].x + 2.0 * t * (1.0 - t) * c->p[1].x + t * t * c->p[2].x;
+        float y = (1.0 - t) * (1.0 - t) * c->p[0].y + 2.0 * t * (1.0 - t) * c->p[1].y + t * t * c->p[2].y;
+        q[0] = (int16_t)(x * size / upem) + _x;
+        q[1] = (int16_t)((bbtt.ascender - y) * size / upem) + _y;
+        if (k) {
+            bbttAddLine(&bbtt, prev[0], prev[1], q[0], q[1]);
+        }
+        prev[0] = q[0];
+        prev[1] = q[1];
+    }
+} /* CurveFloat() */
+
+static void CopyPoints(ttCoordinate_t *pOut)
+{
+    memcpy(pOut, bbtt.points, bbtt.numPoints * sizeof(ttCoordinate_t));
+} /* CopyPoints() */
+
+static int SamePoint(const ttCoordinate_t *a, const ttCoordinate_t *b)
+{
+    return a->x == b->x && a->y == b->y;
+} /* SamePoint() */
+
+int main(int argc, char **argv)
+{
+    static const char *szDefault[] = {"12", "33", "150", "150a"};
+    static ttCoordinate_t lib[MAX_CURVE_STEPS + 1], exact[MAX_CURVE_STEPS + 1], flt[MAX_CURVE_STEPS + 1];
+    const char **pSizes = (argc > 2) ? (const char **)&argv[2] : szDefault;
+    int iSizes = (argc > 2) ? argc - 2 : 4;
+    std::vector<uint8_t> font;
+    int iGlyphs, iTable;
+    FILE *f;
+
+    if (argc < 2) {
+        printf("usage: curvecheck <font.ttf> [size[a] ...]\n");
+        return -1;
+    }
+    f = fopen(argv[1], "rb");
+    if (f == NULL) {
+        printf("Can't open %s\n", argv[1]);
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    font.resize(ftell(f));
+    fseek(f, 0, SEEK_SET);
+    if (fread(font.data(), 1, font.size(), f) != font.size()) {
+        printf("Error reading %s\n", argv[1]);
+        return -1;
+    }
+    fclose(f);
+    bbttInit(&bbtt);
+    if (!bbttSetTtfPointer(&bbtt, font.data(), (uint32_t)font.size(), 0)) {
+        printf("%s isn't a usable font\n", argv[1]);
+        return -1;
+    }
+    iTable = bbttFindTable(&bbtt, TT_TAG('l', 'o', 'c', 'a'));
+    iGlyphs = (iTable < 0) ? 0 : (int)(bbtt.table[iTable].length / (bbtt.headTable.indexToLocFormat ? 4 : 2)) - 1;
+
+    printf("%-6s %8s %10s %8s %8s %8s %10s %10s %10s\n", "size", "curves", "points", "lib off", "flt off", "chords", "lib ns", "exact ns", "float ns");
+    for (int s = 0; s < iSizes; s++) {
+        uint16_t u16Pixels = (uint16_t)atoi(pSizes[s]);
+        uint16_t size = (strchr(pSizes[s], 'a')) ? u16Pixels << AA_SHIFT : u16Pixels;
+        std::vector<tCurve> curves;
+        long lPoints = 0, lLibOff = 0, lFloatOff = 0, lChords = 0;
+        ttScale_t scale;
+
+        if (u16Pixels == 0) {
+            continue;
+        }
+        bbtt.characterSize = u16Pixels; // bbttCurveSteps counts output pixels
+        scale.q = ((uint32_t)size << 16) / bbtt.headTable.unitsPerEm;
+        scale.r = ((uint32_t)size << 16) % bbtt.headTable.unitsPerEm;
+        scale.iMax = ((uint32_t)8191 * bbtt.headTable.unitsPerEm) / size;
+        for (int g = 0; g < iGlyphs; g++) {
+            if (bbttReadGlyph(&bbtt, (uint16_t)g, 0)) {
+                GlyphCurves(curves);
+            }
+        }
+        for (size_t c = 0; c < curves.size(); c++) {
+            const tCurve *pC = &curves[c];
+            if (abs(pC->p[0].x) > scale.iMax || abs(pC->p[1].x) > scale.iMax || abs(pC->p[2].x) > scale.iMax ||
+                abs(bbtt.ascender - pC->p[0].y) > scale.iMax || abs(bbtt.ascender - pC->p[1].y) > scale.iMax ||
+                abs(bbtt.ascender - pC->p[2].y) > scale.iMax) {
+                lChords++; // too far out for 16.16; the library draws a chord
+                continue;
+            }
+            for (int o = 0; o <= 7; o += 7) {
+                CurveExact(pC, o, o, size);
+                CopyPoints(exact);
+                CurveFloat(pC, o, o, size);
+                CopyPoints(flt);
+                CurveLibrary(pC, o, o, size, &scale);
+                CopyPoints(lib);
+                for (int k = 0; k <= pC->n; k++) {
+                    lPoints++;
+                    lLibOff += !SamePoint(&lib[k], &exact[k]);
+                    lFloatOff += !SamePoint(&flt[k], &exact[k]);
+                }
+            }
+        }
+        // time each evaluator over all of the curves
+        double dNs[3];
+        int iPasses = 20;
+        for (int e = 0; e < 3; e++) {
+            auto start = std::chrono::steady_clock::now();
+            for (int p = 0; p < iPasses; p++) {
+                for (size_t c = 0; c < curves.size(); c++) {
+                    if (e == 0) {
+                        CurveLibrary(&curves[c], 0, 0, size, &scale);
+                    } else if (e == 1) {
+                        CurveExact(&curves[c], 0, 0, size);
+                    } else {
+                        CurveFloat(&curves[c], 0, 0, size);
+                    }
+                    i16Sink = bbtt.points[curves[c].n].x;
+                }
+            }
+            auto end = std::chrono::steady_clock::now();
+            dNs[e] = std::chrono::duration<double, std::nano>(end - start).count() / ((double)curves.size() * iPasses);
+        }
+        printf("%-6s %8zu %10ld %8ld %8ld %8ld %10.1f %10.1f %10.1f\n", pSizes[s], curves.size(), lPoints, lLibOff, lFloatOff, lChords, dNs[0], dNs[1], dNs[2]);
+    }
+    return 0;
+} /* main() */
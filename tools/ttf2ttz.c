@@ -0,0 +1,256 @@
+//
+// ttf2ttz - convert a TrueType font into the block compressed container
+// that bb_truetype's setTtzPointer() draws from
+//
+// Copyright (c) 2024 BitBank Software, Inc.
+// MIT License (see the LICENSE file of bb_truetype)
+//
+// build: cc -O2 -o ttf2ttz ttf2ttz.c
+// usage: ttf2ttz [-b <block size>] <font.ttf> <output.ttz | output.h>
+//
+// The font is split into fixed size blocks (4096 bytes unless -b is given) and
+// each one is compressed on its own with LZ77 sequences in the LZ4 style, so the
+// reader only has to decompress the blocks it touches. The container layout is
+// described in bb_truetype.h. An output name ending in .h writes a C array to
+// include in a sketch instead of a binary file.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+
+#define HEADER_SIZE 12
+#define MIN_MATCH 4
+#define HASH_BITS 14
+#define MAX_CHAIN 256
+
+static void Put32(uint8_t *p, uint32_t u32)
+{
+    p[0] = (uint8_t)u32;
+    p[1] = (uint8_t)(u32 >> 8);
+    p[2] = (uint8_t)(u32 >> 16);
+    p[3] = (uint8_t)(u32 >> 24);
+} /* Put32() */
+
+static uint32_t Hash4(const uint8_t *p)
+{
+    uint32_t u32 = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    return (u32 * 2654435761u) >> (32 - HASH_BITS);
+} /* Hash4() */
+
+static uint8_t *PutLength(uint8_t *d, int iLen)
+{
+    while (iLen >= 255) {
+        *d++ = 255;
+        iLen -= 255;
+    }
+    *d++ = (uint8_t)iLen;
+    return d;
+} /* PutLength() */
+
+//
+// Write one sequence (iMatch == 0 for the final literals)
+//
+static uint8_t *PutSequence(uint8_t *d, const uint8_t *pLiterals, int iLiterals, int iOffset, int iMatch)
+{
+    int iLitCode = (iLiterals < 15) ? iLiterals : 15;
+    int iMatchCode = 0;
+
+    if (iMatch) {
+        iMatchCode = (iMatch - MIN_MATCH < 15) ? iMatch - MIN_MATCH : 15;
+    }
+    *d++ = (uint8_t)((iLitCode << 4) | iMatchCode);
+    if (iLitCode == 15) {
+        d = PutLength(d, iLiterals - 15);
+    }
+    memcpy(d, pLiterals, iLiterals);
+    d += iLiterals;
+    if (iMatch) {
+        *d++ = (uint8_t)iOffset;
+        *d++ = (uint8_t)(iOffset >> 8);
+        if (iMatchCode == 15) {
+            d = PutLength(d, iMatch - MIN_MATCH - 15);
+        }
+    }
+    return d;
+} /* PutSequence() */
+
+//
+// Longest earlier match for position i of the block
+//
+static int FindMatch(const uint8_t *s, int i, int iLen, const int *pPrev, const int *pHead, int *pOffset)
+{
+    int iBest = 0, iChain = MAX_CHAIN;
+    int j = pHead[Hash4(&s[i])];
+
+    while (j >= 0 && iChain--) {
+        int k = 0;
+        while (i + k < iLen && s[j + k] == s[i + k]) {
+            k++;
+        }
+        if (k > iBest) {
+            iBest = k;
+            *pOffset = i - j;
+            if (i + k == iLen) {
+                break;
+            }
+        }
+        j = pPrev[j];
+    }
+    return (iBest >= MIN_MATCH) ? iBest : 0;
+} /* FindMatch() */
+
+static void InsertHash(const uint8_t *s, int i, int iLen, int *pPrev, int *pHead)
+{
+    if (i + MIN_MATCH <= iLen) {
+        uint32_t h = Hash4(&s[i]);
+        pPrev[i] = pHead[h];
+        pHead[h] = i;
+    }
+} /* InsertHash() */
+
+//
+// Compress one block; returns the compressed size
+// (d needs room for iLen + iLen/255 + 16 bytes)
+//
+static int CompressBlock(const uint8_t *s, int iLen, uint8_t *d, int *pPrev, int *pHead)
+{
+    uint8_t *pStart = d;
+    int i = 0, iAnchor = 0;
+
+    for (i = 0; i < (1 << HASH_BITS); i++) {
+        pHead[i] = -1;
+    }
+    i = 0;
+    while (i + MIN_MATCH <= iLen) {
+        int iOffset = 0, iNextOffset = 0;
+        int iMatch = FindMatch(s, i, iLen, pPrev, pHead, &iOffset);
+        InsertHash(s, i, iLen, pPrev, pHead);
+        if (iMatch == 0) {
+            i++;
+            continue;
+        }
+        // lazy matching: take a literal if the next position has a longer match
+        if (i + 1 + MIN_MATCH <= iLen && FindMatch(s, i + 1, iLen, pPrev, pHead, &iNextOffset) > iMatch) {
+            i++;
+            continue;
+        }
+        d = PutSequence(d, &s[iAnchor], i - iAnchor, iOffset, iMatch);
+        while (--iMatch) {
+            InsertHash(s, ++i, iLen, pPrev, pHead);
+        }
+        i++;
+        iAnchor = i;
+    }
+    if (iAnchor < iLen) {
+        d = PutSequence(d, &s[iAnchor], iLen - iAnchor, 0, 0);
+    }
+    return (int)(d - pStart);
+} /* CompressBlock() */
+
+static int WriteHeaderFile(FILE *f, const char *szName, const uint8_t *pData, uint32_t u32Size, uint32_t u32FontSize)
+{
+    char szVar[256];
+    const char *p = strrchr(szName, '/');
+    int i;
+
+    p = (p) ? p + 1 : szName;
+    for (i = 0; p[i] && p[i] != '.' && i < (int)sizeof(szVar) - 5; i++) {
+        szVar[i] = isalnum((unsigned char)p[i]) ? p[i] : '_';
+    }
+    strcpy(&szVar[i], "_ttz");
+    fprintf(f, "// Created with ttf2ttz (bb_truetype/tools)\n//\n");
+    fprintf(f, "// Block compressed font; draw it with setTtzPointer()\n");
+    fprintf(f, "// Data size = %u bytes (%u uncompressed)\n//\n", u32Size, u32FontSize);
+    fprintf(f, "// for non-Arduino builds...\n#ifndef PROGMEM\n#define PROGMEM\n#endif\n");
+    fprintf(f, "const uint8_t %s[] PROGMEM = {\n", szVar);
+    for (i = 0; i < (int)u32Size; i++) {
+        if ((i & 15) == 0) fprintf(f, "\t");
+        fprintf(f, "0x%02x%s", pData[i], (i == (int)u32Size - 1) ? "};\n" : ",");
+        if ((i & 15) == 15 && i != (int)u32Size - 1) fprintf(f, "\n");
+    }
+    return 1;
+} /* WriteHeaderFile() */
+
+int main(int argc, char **argv)
+{
+    int iBlockSize = 4096, iShift, iArg = 1;
+    uint32_t u32FontSize, u32BlockCount, u32Out, b;
+    int iStored = 0;
+    uint8_t *pFont, *pOut;
+    int *pPrev, *pHead;
+    FILE *f;
+    const char *szOut;
+    size_t len;
+
+    if (argc > 2 && strcmp(argv[1], "-b") == 0) {
+        iBlockSize = atoi(argv[2]);
+        iArg = 3;
+    }
+    for (iShift = 8; iShift <= 15 && (1 << iShift) != iBlockSize; iShift++) {
+    }
+    if (argc - iArg != 2 || iShift > 15) {
+        printf("usage: ttf2ttz [-b <block size>] <font.ttf> <output.ttz | output.h>\n");
+        printf("block size is a power of 2 from 256 to 32768 (default 4096)\n");
+        return -1;
+    }
+    f = fopen(argv[iArg], "rb");
+    if (f == NULL) {
+        printf("Can't open %s\n", argv[iArg]);
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    u32FontSize = (uint32_t)ftell(f);
+    fseek(f, 0, SEEK_SET);
+    pFont = (uint8_t *)malloc(u32FontSize ? u32FontSize : 1);
+    if (u32FontSize == 0 || fread(pFont, 1, u32FontSize, f) != u32FontSize) {
+        printf("Error reading %s\n", argv[iArg]);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+
+    u32BlockCount = (u32FontSize + iBlockSize - 1) >> iShift;
+    u32Out = HEADER_SIZE + (u32BlockCount + 1) * 4;
+    pOut = (uint8_t *)malloc(u32Out + u32FontSize + u32BlockCount * (iBlockSize / 255 + 16));
+    pPrev = (int *)malloc(iBlockSize * sizeof(int));
+    pHead = (int *)malloc((1 << HASH_BITS) * sizeof(int));
+    memcpy(pOut, "TTZ1", 4);
+    Put32(&pOut[4], u32FontSize);
+    pOut[8] = (uint8_t)iShift;
+    pOut[9] = pOut[10] = pOut[11] = 0;
+    for (b = 0; b < u32BlockCount; b++) {
+        uint32_t u32Start = b << iShift;
+        int iLen = (u32FontSize - u32Start < (uint32_t)iBlockSize) ? (int)(u32FontSize - u32Start) : iBlockSize;
+        int iPacked = CompressBlock(&pFont[u32Start], iLen, &pOut[u32Out], pPrev, pHead);
+        Put32(&pOut[HEADER_SIZE + b * 4], u32Out);
+        if (iPacked >= iLen) { // store it; the reader recognizes it by its size
+            memcpy(&pOut[u32Out], &pFont[u32Start], iLen);
+            iPacked = iLen;
+            iStored++;
+        }
+        u32Out += iPacked;
+    }
+    Put32(&pOut[HEADER_SIZE + u32BlockCount * 4], u32Out);
+
+    szOut = argv[iArg + 1];
+    len = strlen(szOut);
+    f = fopen(szOut, (len > 2 && strcmp(&szOut[len - 2], ".h") == 0) ? "w" : "wb");
+    if (f == NULL) {
+        printf("Can't create %s\n", szOut);
+        return -1;
+    }
+    if (len > 2 && strcmp(&szOut[len - 2], ".h") == 0) {
+        WriteHeaderFile(f, argv[iArg], pOut, u32Out, u32FontSize);
+    } else {
+        fwrite(pOut, 1, u32Out, f);
+    }
+    fclose(f);
+    printf("%s: %u -> %u bytes (%d%%), %u blocks of %d bytes (%d stored)\n", argv[iArg], u32FontSize, u32Out, (int)((u32Out * 100ull) / u32FontSize), u32BlockCount, iBlockSize, iStored);
+    free(pFont);
+    free(pOut);
+    free(pPrev);
+    free(pHead);
+    return 0;
+} /* main() */